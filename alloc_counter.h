@@ -0,0 +1,50 @@
+/**
+ * @file
+ * @brief Counter of the heap allocations of each thread, through replaced global operators new and delete.
+ * @details
+ * Part of the stage profile, compiled in with -DALLOC_PROFILE (which implies -DSTAGE_PROFILE): the stage timers
+ * read the count of the thread when a stage begins and ends, so the profile shows the allocations and bytes
+ * allocated by each stage, and the allocations per row it processed.
+ * Only allocations through operator new are counted, i.e. the standard containers and strings outside an arena;
+ * the rows, cells and segments allocated from an arena (see ArenaAllocator) are not, since they do not reach the heap.
+ * The count is kept in plain thread-local integers, so counting takes neither a lock nor an atomic.
+ */
+#include <cstdlib>
+#include <new>
+
+struct AllocCount {
+  long allocations;
+  long bytes;
+};
+
+// @returns the heap allocations of the calling thread so far
+inline AllocCount &threadAllocs() {
+  static thread_local AllocCount count = {0, 0};
+  return count;
+}
+
+void *operator new(size_t size) {
+  AllocCount &count = threadAllocs();
+  count.allocations++;
+  count.bytes += size;
+  void *p = malloc(size > 0 ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  AllocCount &count = threadAllocs();
+  count.allocations++;
+  count.bytes += size;
+  return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+
+// not inlined, so the compiler does not see free paired with the new expressions, and warn about a mismatch
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
@@ -0,0 +1,285 @@
+/**
+ * @file
+ * @brief Implementation of methods for the movement trajectory analysis.
+ * @details
+ * The AnalysisGraph is a lazily evaluated graph of columns derived from the sorted data logs of a user.
+ * Each column is computed at most once, and only when an analysis (or a column depending on it) asks for it.
+ *
+ *     datetime --> time --> pairTimeDiff --+
+ *                                          +--> speed
+ *     lat/lon -----------> pairDistance ---+
+ *     tag ---------------> areaID --> areaRows
+ */
+#include <algorithm>
+#include <functional>
+
+// a column of the rows of a user, allocated from the current arena
+template <class T> using COLUMN = std::vector<T, ColumnAllocator<T> >;
+
+template <class T>
+class DerivedColumn {
+private:
+  bool ready_;
+  COLUMN<T> values_;
+  std::function<void(COLUMN<T>&)> compute_;
+
+public:
+  DerivedColumn(std::function<void(COLUMN<T>&)> compute) : ready_(false), compute_(compute) {};
+  const COLUMN<T>& get() {
+    if (!ready_) {
+      RunMetrics::global().add(RunMetrics::global().columnMisses, 1);
+      compute_(values_);
+      ready_ = true;
+    } else {
+      RunMetrics::global().add(RunMetrics::global().columnHits, 1);
+    }
+    return values_;
+  };
+  bool isReady() { return ready_; };
+  void invalidate() {
+    values_.clear();
+    ready_ = false;
+  };
+};
+
+class AnalysisGraph {
+private:
+  ROWLIST &rowList_;
+  std::function<int(DataRow &)> areaOf_; // labels a row with its area, 0 if it is in no area
+
+  DerivedColumn<time_t> time_;
+  DerivedColumn<double> pairDistance_;         // km from the previous row, 0 for the first row
+  DerivedColumn<double> pairTimeDiff_;         // seconds from the previous row, 0 for the first row
+  DerivedColumn<double> speed_;                // km per hour from the previous row, 0 if the time difference is 0
+  DerivedColumn<int> areaID_;
+  DerivedColumn<COLUMN<int> > areaRows_;  // row indices grouped by areaID
+
+public:
+  AnalysisGraph(ROWLIST &rowList);
+  AnalysisGraph(const AnalysisGraph &) = delete;
+  AnalysisGraph& operator=(const AnalysisGraph &) = delete;
+
+  ROWLIST& rows() { return rowList_; };
+  void setAreaLabeler(std::function<int(DataRow &)> areaOf);
+  const std::function<int(DataRow &)>& areaLabeler() { return areaOf_; };
+  void invalidate();
+
+  // whether a column is already computed, so that reading it does not cost a pass over the rows
+  bool timeReady() { return time_.isReady() && pairTimeDiff_.isReady(); };
+  bool pairDistanceReady() { return pairDistance_.isReady(); };
+  bool areaIDReady() { return areaID_.isReady(); };
+
+  const COLUMN<time_t>& time() { return time_.get(); };
+  const COLUMN<double>& pairDistance() { return pairDistance_.get(); };
+  const COLUMN<double>& pairTimeDiff() { return pairTimeDiff_.get(); };
+  const COLUMN<double>& speed() { return speed_.get(); };
+  const COLUMN<int>& areaID() { return areaID_.get(); };
+  const COLUMN<COLUMN<int> >& areaRows() { return areaRows_.get(); };
+};
+
+AnalysisGraph::AnalysisGraph(ROWLIST &rowList) :
+  rowList_(rowList),
+  time_([this](COLUMN<time_t> &col) {
+    col.resize(rowList_.size());
+    for (int i = 0; i < rowList_.size(); i++)
+      col[i] = getTimeValue(rowList_[i].getDateTime());
+  }),
+  pairDistance_([this](COLUMN<double> &col) {
+    col.assign(rowList_.size(), 0);
+    for (int i = 1; i < rowList_.size(); i++)
+      col[i] = distanceEarth(rowList_[i - 1].getLat(), rowList_[i - 1].getLon(), rowList_[i].getLat(), rowList_[i].getLon());
+  }),
+  pairTimeDiff_([this](COLUMN<double> &col) {
+    const COLUMN<time_t> &t = time();
+    col.assign(t.size(), 0);
+    for (int i = 1; i < t.size(); i++) {
+      col[i] = difftime(t[i], t[i - 1]);
+      if (col[i] < 0) {
+        std::cout << "ERROR: timeDiff < 0. " << col[i] << std::endl;
+        exit(0);
+      }
+    }
+  }),
+  speed_([this](COLUMN<double> &col) {
+    const COLUMN<double> &dist = pairDistance();
+    const COLUMN<double> &dt = pairTimeDiff();
+    col.assign(dist.size(), 0);
+    for (int i = 1; i < dist.size(); i++)
+      if (dt[i] != 0) col[i] = 3600 * dist[i] / dt[i];
+  }),
+  areaID_([this](COLUMN<int> &col) {
+    if (!areaOf_) {
+      std::cout << "ERROR: Areas have not been labelled." << std::endl;
+      exit(0);
+    }
+    col.resize(rowList_.size());
+    for (int i = 0; i < rowList_.size(); i++) {
+      col[i] = areaOf_(rowList_[i]);
+      rowList_[i].setAreaID(col[i]); // keep DataRow::getAreaID consistent with the column
+    }
+  }),
+  areaRows_([this](COLUMN<COLUMN<int> > &col) {
+    const COLUMN<int> &area = areaID();
+    col.clear();
+    for (int i = 0; i < area.size(); i++) {
+      if (area[i] >= col.size()) col.resize(area[i] + 1);
+      col[area[i]].push_back(i);
+    }
+  }) {}
+
+void AnalysisGraph::setAreaLabeler(std::function<int(DataRow &)> areaOf) {
+  areaOf_ = areaOf;
+  areaID_.invalidate();
+  areaRows_.invalidate();
+}
+
+// drop every column, e.g. after rowList_ has been modified
+void AnalysisGraph::invalidate() {
+  time_.invalidate();
+  pairDistance_.invalidate();
+  pairTimeDiff_.invalidate();
+  speed_.invalidate();
+  areaID_.invalidate();
+  areaRows_.invalidate();
+}
+
+// Same as centerOfGravity(list, areaID), but only visits the rows of the area and prints to log (if any).
+// Each row is in one area, so its unit vector is computed here rather than kept in a column of every row.
+std::vector<double> centerOfGravity(AnalysisGraph &graph, int areaID, std::ostream *log) {
+  std::vector<double> midpoints(2); //Lat, Lon
+  if (log) {
+    *log << "\nMethod: Center of gravity" << std::endl;
+    *log << "Area " << std::to_string(areaID) << std::endl;
+  }
+  ROWLIST &list = graph.rows();
+  const COLUMN<COLUMN<int> > &areaRows = graph.areaRows();
+  double count = 0;
+  float cart_x = 0, cart_y = 0, cart_z = 0;
+  if (areaID < areaRows.size()) {
+    for (int i : areaRows[areaID]) {
+      double lat = deg2rad(list[i].getLat()), lon = deg2rad(list[i].getLon());
+      count++;
+      cart_x += cos(lat) * cos(lon);
+      cart_y += cos(lat) * sin(lon);
+      cart_z += sin(lat);
+    }
+  }
+  cart_x /= count;
+  cart_y /= count;
+  cart_z /= count;
+  midpoints[0] = rad2deg(atan2(cart_z, sqrt(pow(cart_x, 2) + pow(cart_y, 2))));
+  midpoints[1] = rad2deg(atan2(cart_y, cart_x));
+  if (log) {
+    log->precision(10);
+    *log << "Midpoint: " << midpoints[0] << ", " << midpoints[1] << std::endl;
+  }
+
+  return midpoints;
+}
+
+// Same as averageLatLon(list, areaID), but only visits the rows of the area and prints to log (if any).
+std::vector<double> averageLatLon(AnalysisGraph &graph, int areaID, std::ostream *log) {
+  std::vector<double> midpoints(2); //Lat, Lon
+  if (log) {
+    *log << "\nMethod: Average latitude/longitude" << std::endl;
+    *log << "Area " << std::to_string(areaID) << std::endl;
+  }
+  ROWLIST &list = graph.rows();
+  const COLUMN<COLUMN<int> > &areaRows = graph.areaRows();
+  double sumLon = 0, sumLat = 0;
+  int count = 0;
+  if (areaID < areaRows.size()) {
+    for (int i : areaRows[areaID]) {
+      sumLon += list[i].getLon();
+      sumLat += list[i].getLat();
+      count++;
+    }
+  }
+  midpoints[0] = sumLat / count;
+  midpoints[1] = sumLon / count;
+  if (log) {
+    log->precision(10);
+    *log << "Midpoint: " << midpoints[0] << ", " << midpoints[1] << std::endl;
+  }
+
+  return midpoints;
+}
+
+/**
+ * Same outputs as midpointAnalysis(list, areaCount, useAverage).
+ * The distance from the midpoint is computed once per row, and the CDF is read from the sorted distances
+ * instead of rescanning the whole list for each bound.
+ * The statistics are printed to log (if any), and the CDF files (prefixed by prefix) are written if writeCdf is set.
+ */
+void midpointAnalysis(AnalysisGraph &graph, int areaCount, bool useAverage, std::ostream *log, const std::string &prefix, bool writeCdf) {
+  PROFILE_STAGE("midpointAnalysis");
+  std::string method = "gravity";
+  if (useAverage) method = "average";
+  ROWLIST &list = graph.rows();
+  const COLUMN<COLUMN<int> > &areaRows = graph.areaRows();
+  std::vector<double> diffs;
+  for (int i = 1; i <= areaCount; i++) {
+    std::vector<double> midpoints (2, 0);
+    if (useAverage) midpoints = averageLatLon(graph, i, log);
+    else midpoints = centerOfGravity(graph, i, log);
+    double meanLat = midpoints[0], meanLon = midpoints[1];
+
+    diffs.clear();
+    if (i < areaRows.size()) {
+      for (int r : areaRows[i])
+        diffs.push_back(distanceEarth(meanLat, meanLon, list[r].getLat(), list[r].getLon()));
+    }
+    double count = diffs.size();
+    PROFILE_ROWS(diffs.size());
+
+    double diffSum = 0, diffMax = 0, diffMin = 1;
+    for (double diff : diffs) {
+      diffSum += diff;
+      diffMax = fmax(diffMax, diff);
+      diffMin = fmin(diffMin, diff);
+    }
+    if (log) {
+      *log << "\taverage difference: " << diffSum / count << std::endl;
+      *log << "\tmaximum difference: " << diffMax << std::endl;
+      *log << "\tminimum difference: " << diffMin << std::endl;
+    }
+    if (!writeCdf) continue;
+
+    // output the file for CDF plot
+    std::ofstream ofsMid(prefix + method + "-area-" + std::to_string(i) + ".csv");
+    if (i == 1) diffMax = 0.7;  // maxdiff of area 1
+    else if (i == 2) diffMax = 0.4; // maxdiff of area 2
+    std::sort(diffs.begin(), diffs.end());
+    double numSample = 50;
+    for (int j = 1; j <= numSample; j++) {
+      double bound = diffMax * j / numSample;
+      ofsMid << bound << ",";
+      int lowerCount = std::upper_bound(diffs.begin(), diffs.end(), bound) - diffs.begin();
+      ofsMid << 100 * lowerCount / count << std::endl;
+    }
+
+    countBytesWritten(ofsMid.tellp());
+    ofsMid.close();
+  }
+}
+
+// Same as generateGeoFiles(list, areaCount), but only visits the rows of each area and prefixes the file names.
+void generateGeoFiles(AnalysisGraph &graph, int areaCount, const std::string &prefix) {
+  PROFILE_STAGE("generateGeoFiles");
+  ROWLIST &list = graph.rows();
+  const COLUMN<COLUMN<int> > &areaRows = graph.areaRows();
+  for (int i = 1; i <= areaCount; i++) {
+    std::ofstream ofsLon(prefix + "area-" + std::to_string(i) + "-lon.txt");
+    std::ofstream ofsLat(prefix + "area-" + std::to_string(i) + "-lat.txt");
+    if (i < areaRows.size()) {
+      for (int r : areaRows[i]) {
+        ofsLon << list[r].getLon() << std::endl;
+        ofsLat << list[r].getLat() << std::endl;
+      }
+      PROFILE_ROWS(areaRows[i].size());
+    }
+    countBytesWritten(ofsLon.tellp() + ofsLat.tellp());
+    ofsLon.close();
+    ofsLat.close();
+  }
+}
@@ -0,0 +1,325 @@
+/**
+ * @file
+ * @brief Arena allocation for the analysis of a user.
+ * @details
+ * An Arena hands out small blocks from a few large chunks by bumping a pointer, and returns every chunk in one step
+ * on release(), or keeps them for the next user of a worker on reset(). Small sizes are rounded up to size classes,
+ * four per power of two, and a small block deallocated before then goes to the free list of its class, from which
+ * the next allocation of the class is served, so the copies of segment lists and the old buffers of growing vectors
+ * are reused instead of piling up until the user is done. Blocks of LARGE_BLOCK bytes or more (row stores, columns,
+ * the last buffers of large vectors) get a chunk of their own, returned to the system as soon as they are deallocated.
+ * On reset(), the chunks of the small blocks are kept for the next user, trimmed to the median of the small block
+ * bytes of the last RECENT_RESETS users, so that one large user does not pin its memory in a worker for the rest of a batch.
+ * The analysis of a user runs inside an ArenaScope, so that the containers
+ * using ArenaAllocator (rows, cells, tags, derived columns, segments, json nodes) allocate from the arena of the current thread,
+ * instead of fragmenting the heap and contending on malloc with the other workers.
+ * Without a current arena, ArenaAllocator falls back to operator new and delete.
+ * With huge pages, chunks are mapped on explicit huge pages (MAP_HUGETLB) if the system has reserved some,
+ * or else on 2 MiB aligned mappings advised for transparent huge pages, to cut the TLB misses of scans over
+ * large row stores. If neither mapping is possible, chunks fall back to malloc.
+ */
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include "memory_accounting.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+class Arena {
+private:
+  enum ChunkKind { CHUNK_MALLOC, CHUNK_HUGETLB, CHUNK_TRANSPARENT };
+  struct Chunk {
+    char *data;
+    size_t size;
+    ChunkKind kind;
+  };
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+  std::vector<Chunk> chunks_;         // of the small blocks
+  std::vector<Chunk> largeBlocks_;
+  std::vector<FreeBlock *> freeLists_; // small blocks deallocated since the last reset, by size class
+  std::vector<size_t> recent_;        // bytes of small blocks taken from the chunks by the users of the last resets
+  size_t firstChunkSize_;
+  size_t chunkSize_;   // size of the next chunk
+  size_t used_;        // bytes used in the last chunk
+  size_t bytesInUse_;  // bytes of the blocks handed out and not deallocated
+  size_t smallBytes_;  // bytes taken from the chunks since the last reset, free blocks included
+  size_t footprint_;   // smallBytes_ and the bytes of the large blocks
+  size_t highWater_;   // the largest footprint_ since the last reset: the memory the user needed
+  size_t capacity_;    // bytes of all chunks and large blocks
+  bool hugePages_;
+  size_t hugeBytes_[3]; // bytes of the chunks of each kind
+
+  Chunk newChunk(size_t size);
+  void freeChunk(const Chunk &c);
+  void addChunk(size_t minSize);
+  Chunk mapHugeChunk(size_t size);
+  static int sizeClass(size_t bytes);
+  static size_t classSize(int c);
+
+public:
+  static const size_t ALIGNMENT = 16; // of every block, at least alignof(std::max_align_t) on common ABIs
+  static const size_t LARGE_BLOCK = 1 << 20;
+  static const int RECENT_RESETS = 8;
+
+  Arena(size_t chunkSize = 1 << 20, bool hugePages = false) :
+    firstChunkSize_(chunkSize), chunkSize_(chunkSize), used_(0), bytesInUse_(0), smallBytes_(0), footprint_(0),
+    highWater_(0), capacity_(0), hugePages_(hugePages), hugeBytes_() {};
+  Arena(const Arena &) = delete;
+  Arena& operator=(const Arena &) = delete;
+  ~Arena() { release(); };
+
+  void *allocate(size_t bytes);
+  void deallocate(void *p, size_t bytes);
+  bool owns(const void *p);
+  void release();
+  void reset();
+  size_t bytesInUse() { return bytesInUse_; };
+  size_t highWater() { return highWater_; };
+  size_t capacity() { return capacity_; };
+  size_t explicitHugePageBytes() { return hugeBytes_[CHUNK_HUGETLB]; };
+  size_t transparentHugePageBytes() { return hugeBytes_[CHUNK_TRANSPARENT]; }; // advised, not guaranteed by the kernel
+
+  // the arena of the current thread, nullptr if there is none
+  static Arena *&current() {
+    static thread_local Arena *arena = nullptr;
+    return arena;
+  };
+};
+
+// Make arena the arena of the current thread until the end of the scope.
+class ArenaScope {
+private:
+  Arena *previous_;
+
+public:
+  ArenaScope(Arena &arena) : previous_(Arena::current()) { Arena::current() = &arena; };
+  ~ArenaScope() { Arena::current() = previous_; };
+};
+
+// @returns a chunk of size bytes (a multiple of HUGE_PAGE_SIZE) backed by huge pages, or a null chunk
+Arena::Chunk Arena::mapHugeChunk(size_t size) {
+  Chunk c = {nullptr, size, CHUNK_HUGETLB};
+#ifdef MAP_HUGETLB
+  void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    c.data = static_cast<char *>(p);
+    return c;
+  }
+#endif
+#ifdef MADV_HUGEPAGE
+  // over-map by a huge page, and trim the mapping to a 2 MiB aligned range
+  char *p2 = static_cast<char *>(mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (p2 == MAP_FAILED) return c;
+  size_t head = (HUGE_PAGE_SIZE - reinterpret_cast<uintptr_t>(p2) % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+  if (head > 0) munmap(p2, head);
+  munmap(p2 + head + size, HUGE_PAGE_SIZE - head);
+  c.data = p2 + head;
+  c.kind = CHUNK_TRANSPARENT;
+  madvise(c.data, size, MADV_HUGEPAGE);
+#endif
+  return c;
+}
+
+// @returns a chunk of at least size bytes, on huge pages if the arena uses them
+Arena::Chunk Arena::newChunk(size_t size) {
+  Chunk c = {nullptr, size, CHUNK_MALLOC};
+  if (hugePages_) {
+    size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    c = mapHugeChunk(size);
+  }
+  if (!c.data) {
+    c.data = static_cast<char *>(malloc(size));
+    c.kind = CHUNK_MALLOC;
+  }
+  if (!c.data) {
+    std::cout << "ERROR: The arena is out of memory." << std::endl;
+    exit(0);
+  }
+  c.size = size;
+  capacity_ += size;
+  hugeBytes_[c.kind] += size;
+  return c;
+}
+
+void Arena::freeChunk(const Chunk &c) {
+  if (c.kind == CHUNK_MALLOC) free(c.data);
+  else munmap(c.data, c.size);
+  capacity_ -= c.size;
+  hugeBytes_[c.kind] -= c.size;
+}
+
+void Arena::addChunk(size_t minSize) {
+  chunks_.push_back(newChunk(chunkSize_ > minSize ? chunkSize_ : minSize));
+  used_ = 0;
+  if (chunkSize_ < (64 << 20)) chunkSize_ *= 2; // grow geometrically up to 64 MiB chunks
+}
+
+/**
+ * Size classes: multiples of 16 bytes up to 128 bytes, then four classes between consecutive powers of two,
+ * so rounding a block up to its class wastes at most a quarter of it.
+ * @returns the class of a block of bytes
+ */
+int Arena::sizeClass(size_t bytes) {
+  if (bytes <= 128) return bytes == 0 ? 0 : (int)((bytes - 1) / 16);
+  int m = 7; // 2^m < bytes <= 2^(m + 1)
+  while (((size_t)2 << m) < bytes) m++;
+  size_t step = (size_t)1 << (m - 2);
+  return 8 + (m - 7) * 4 + (int)((bytes - ((size_t)1 << m) - 1) / step);
+}
+
+// @returns the size of the blocks of class c
+size_t Arena::classSize(int c) {
+  if (c < 8) return (c + 1) * 16;
+  int m = 7 + (c - 8) / 4;
+  return ((size_t)1 << m) + ((c - 8) % 4 + 1) * ((size_t)1 << (m - 2));
+}
+
+// @returns a block of at least bytes bytes, aligned to ALIGNMENT, from the free list of its class or else a chunk
+void *Arena::allocate(size_t bytes) {
+  if (bytes >= LARGE_BLOCK) {
+    largeBlocks_.push_back(newChunk(bytes));
+    bytesInUse_ += bytes;
+    footprint_ += largeBlocks_.back().size;
+    if (footprint_ > highWater_) highWater_ = footprint_;
+    return largeBlocks_.back().data;
+  }
+  int c = sizeClass(bytes);
+  size_t size = classSize(c);
+  bytesInUse_ += size;
+  if (c < freeLists_.size() && freeLists_[c]) {
+    FreeBlock *block = freeLists_[c];
+    freeLists_[c] = block->next;
+    return block;
+  }
+  if (chunks_.empty() || used_ + size > chunks_.back().size) addChunk(size);
+  void *p = chunks_.back().data + used_;
+  used_ += size;
+  smallBytes_ += size;
+  footprint_ += size;
+  if (footprint_ > highWater_) highWater_ = footprint_;
+  return p;
+}
+
+// return a large block of bytes bytes allocated from this arena to the system, or put a small one on its free list
+void Arena::deallocate(void *p, size_t bytes) {
+  if (bytes >= LARGE_BLOCK) {
+    for (size_t i = largeBlocks_.size(); i-- > 0;) {
+      if (largeBlocks_[i].data != p) continue;
+      bytesInUse_ -= bytes;
+      footprint_ -= largeBlocks_[i].size;
+      freeChunk(largeBlocks_[i]);
+      largeBlocks_.erase(largeBlocks_.begin() + i);
+      return;
+    }
+    return;
+  }
+  int c = sizeClass(bytes);
+  if (c >= freeLists_.size()) freeLists_.resize(c + 1, nullptr);
+  FreeBlock *block = static_cast<FreeBlock *>(p);
+  block->next = freeLists_[c];
+  freeLists_[c] = block;
+  bytesInUse_ -= classSize(c);
+}
+
+bool Arena::owns(const void *p) {
+  const char *c = static_cast<const char *>(p);
+  for (Chunk &chunk : chunks_) {
+    if (c >= chunk.data && c < chunk.data + chunk.size) return true;
+  }
+  for (Chunk &block : largeBlocks_) {
+    if (c == block.data) return true;
+  }
+  return false;
+}
+
+// free every chunk in one step; nothing allocated from the arena may be used afterwards
+void Arena::release() {
+  for (Chunk &chunk : chunks_) freeChunk(chunk);
+  for (Chunk &block : largeBlocks_) freeChunk(block);
+  chunks_.clear();
+  largeBlocks_.clear();
+  freeLists_.clear();
+  used_ = 0;
+  bytesInUse_ = 0;
+  smallBytes_ = 0;
+  footprint_ = 0;
+  highWater_ = 0;
+}
+
+/**
+ * Forget every allocation but keep memory for the small blocks of the next user: one chunk of the median of the
+ * small block bytes of the last RECENT_RESETS users (rounded up to the first chunk size). The chunks are merged
+ * into it if there are several, or if the one chunk is more than twice as large, so a worker stops allocating
+ * from the system once its arena fits a typical user, and returns the memory of a large user once it is not typical.
+ */
+void Arena::reset() {
+  recent_.push_back(smallBytes_);
+  if (recent_.size() > RECENT_RESETS) recent_.erase(recent_.begin());
+  std::vector<size_t> sorted(recent_);
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+  size_t keep = (sorted[sorted.size() / 2] + firstChunkSize_ - 1) / firstChunkSize_ * firstChunkSize_;
+  if (chunks_.size() > 1 || (chunks_.size() == 1 && chunks_[0].size > 2 * keep)) {
+    for (Chunk &chunk : chunks_) freeChunk(chunk);
+    chunks_.clear();
+    chunkSize_ = firstChunkSize_;
+    if (keep > 0) chunks_.push_back(newChunk(keep));
+  }
+  for (Chunk &block : largeBlocks_) freeChunk(block);
+  largeBlocks_.clear();
+  freeLists_.clear();
+  used_ = 0;
+  bytesInUse_ = 0;
+  smallBytes_ = 0;
+  footprint_ = 0;
+  highWater_ = 0;
+}
+
+/**
+ * Allocator of STL containers allocating from the arena current at its construction.
+ * Memory of the arena is deallocated to its free lists, for the next allocations of the same size class.
+ * Allocated and deallocated bytes are charged to the account of Tag in the MemoryLedger of the current thread.
+ */
+template <class T, class Tag = MemoryTag<MEMORY_OTHER> >
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  template <class U> struct rebind { typedef ArenaAllocator<U, Tag> other; };
+  Arena *arena_;
+
+  ArenaAllocator() : arena_(Arena::current()) {};
+  ArenaAllocator(Arena *arena) : arena_(arena) {};
+  template <class U> ArenaAllocator(const ArenaAllocator<U, Tag> &other) : arena_(other.arena_) {};
+
+  T *allocate(size_t n) {
+    static_assert(alignof(T) <= Arena::ALIGNMENT, "the arena aligns its blocks to Arena::ALIGNMENT");
+    MemoryLedger::current().charge(Tag::account, n * sizeof(T));
+    if (arena_) return static_cast<T *>(arena_->allocate(n * sizeof(T)));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  };
+  void deallocate(T *p, size_t n) {
+    MemoryLedger::current().credit(Tag::account, n * sizeof(T));
+    if (arena_ && arena_->owns(p)) arena_->deallocate(p, n * sizeof(T));
+    else ::operator delete(p);
+  };
+};
+
+template <class T, class U, class Tag>
+bool operator==(const ArenaAllocator<T, Tag> &a, const ArenaAllocator<U, Tag> &b) { return a.arena_ == b.arena_; }
+template <class T, class U, class Tag>
+bool operator!=(const ArenaAllocator<T, Tag> &a, const ArenaAllocator<U, Tag> &b) { return a.arena_ != b.arena_; }
+
+// allocators of the accounts of MemoryLedger
+template <class T> using IngestAllocator = ArenaAllocator<T, MemoryTag<MEMORY_INGEST> >;
+template <class T> using RowAllocator = ArenaAllocator<T, MemoryTag<MEMORY_ROWS> >;
+template <class T> using CellAllocator = ArenaAllocator<T, MemoryTag<MEMORY_CELLS> >;
+template <class T> using ColumnAllocator = ArenaAllocator<T, MemoryTag<MEMORY_COLUMNS> >;
+template <class T> using SegmentAllocator = ArenaAllocator<T, MemoryTag<MEMORY_SEGMENTS> >;
+template <class T> using OutputAllocator = ArenaAllocator<T, MemoryTag<MEMORY_OUTPUT> >;
+
+typedef std::basic_string<char, std::char_traits<char>, CellAllocator<char> > ArenaString;
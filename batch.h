@@ -0,0 +1,225 @@
+/**
+ * @file
+ * @brief Batch driver of the movement trajectory analysis.
+ * @details
+ * analyseBatch analyses each data file of the options as a user, in parallel on up to opt.threads workers,
+ * each with its own arena, and prints their results in the order of the files.
+ * It is shared by the analysis program and the scaling benchmark.
+ */
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
+
+/**
+ * Analyse the idx-th data file as a user and print its results to log.
+ */
+void analyseUser(const Options &opt, int idx, std::ostream &log, TransitionCounter &transitions,
+                 ColocationJoin *colocation) {
+  PROFILE_STAGE_DETAIL("user", opt.dataFiles[idx]);
+  std::string prefix = outputPrefix(opt, idx);
+  std::unique_ptr<ProgressiveAnalysis> progress;
+  if (opt.snapshotEvery > 0)
+    progress.reset(new ProgressiveAnalysis(prefix + "progress.jsonl", opt.interval, opt.snapshotEvery));
+  RunMetrics &metrics = RunMetrics::global();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  User u(opt.dataFiles[idx], opt.sampleCapacity, progress.get());
+  std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+  metrics.add(metrics.readNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(read - start).count());
+  u.setOutputPrefix(prefix);
+  u.setLog(log);
+  u.setColocation(colocation, idx);
+
+  if (opt.outputs & (OUTPUT_CONNECTIONS | OUTPUT_SEGMENTS)) {
+    if (!u.hasCell(opt.targetCell)) {
+      log << "ERROR: This cell does not exist." << std::endl;
+    } else {
+      if (opt.outputs & OUTPUT_CONNECTIONS)
+        log << opt.targetCell << " connections: " << u.numConnections(opt.targetCell) << std::endl;
+      if (opt.outputs & OUTPUT_SEGMENTS) {
+        for (TIMEPAIR tp : u.getTimeSegments(opt.targetCell, opt.interval))
+          log << getTimeString(tp.first, 0) << "-to-" << getTimeString(tp.second, 0) << std::endl;
+      }
+    }
+  }
+
+  start = std::chrono::steady_clock::now();
+  u.analyse(opt.interval, opt.outputs);
+  metrics.add(metrics.analyseNanos,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  if (opt.outputs & OUTPUT_TRANSITIONS) transitions.add(u.transitions());
+  u.reportSampleError();
+  if (opt.verbose) u.reportStats();
+}
+
+/**
+ * Out-of-core mode: sort the rows of the idx-th data file within opt.memoryBudget bytes,
+ * and stream them into the kernels of the selected outputs that work in one pass.
+ */
+void analyseUserOutOfCore(const Options &opt, int idx, std::ostream &log, TransitionCounter &transitions,
+                          ColocationJoin *colocation) {
+  PROFILE_STAGE_DETAIL("user (out of core)", opt.dataFiles[idx]);
+  std::string prefix = outputPrefix(opt, idx);
+  if (opt.outputs & (ANALYSIS_TOPK_CELLS | OUTPUT_PREDICTION))
+    log << "WARNING: The area, midpoint, cdf, geo and predict outputs need every row in memory, and are skipped." << std::endl;
+
+  ScanEngine engine;
+  SpeedSeriesKernel speedSeries(prefix);
+  SpeedSegmentKernel speedSegment(prefix);
+  TransitionKernel transitionKernel(prefix);
+  ColocationKernel colocationKernel(colocation, idx);
+  CellSegmentKernel cellSegments(opt.targetCell, opt.interval, opt.outputs & OUTPUT_CONNECTIONS,
+                                 opt.outputs & OUTPUT_SEGMENTS, log);
+  if (opt.outputs & (OUTPUT_CONNECTIONS | OUTPUT_SEGMENTS)) engine.add(&cellSegments);
+  if (opt.outputs & OUTPUT_SPEED) engine.add(&speedSeries);
+  if (opt.outputs & OUTPUT_MAP) engine.add(&speedSegment);
+  if (opt.outputs & OUTPUT_TRANSITIONS) engine.add(&transitionKernel);
+  if ((opt.outputs & OUTPUT_COLOCATION) && colocation) engine.add(&colocationKernel);
+  if (engine.empty()) return;
+
+  RunMetrics &metrics = RunMetrics::global();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ExternalSorter sorter(opt.memoryBudget, prefix + "spill-");
+  sorter.readFile(opt.dataFiles[idx]);
+  std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+  metrics.add(metrics.readNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(read - start).count());
+  sorter.merge(engine); // the merge runs the kernels
+  if (opt.outputs & OUTPUT_TRANSITIONS) transitions.add(transitionKernel.matrix());
+  metrics.add(metrics.analyseNanos,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - read).count());
+  if (opt.verbose) log << "\nOut-of-core: " << sorter.rows() << " rows sorted in " << sorter.numRuns() << " runs" << std::endl;
+}
+
+// memory used by the analysis of a user
+struct MemoryUsage {
+  MemoryLedger stages;   // live bytes, which do not count the memory freed in the arena and not yet reused
+  size_t arenaHighWater;
+  // bytes to size a worker for the user: the arena high-water mark, or the live bytes out of core (no arena)
+  long requiredBytes() { return std::max((long)arenaHighWater, stages.totalPeak()); };
+};
+
+/**
+ * Analyse the idx-th data file as a user and print its results to log.
+ * Everything the analysis allocates comes from arena, which is reset in one step when the user is done,
+ * keeping its memory for the next user of the worker.
+ * The peak memory of each stage of the analysis is recorded in usage,
+ * and the cell transitions of the user are added to transitions, and its visits to colocation.
+ */
+void analyseUser(const Options &opt, int idx, std::ostream &log, Arena &arena, MemoryUsage &usage,
+                 TransitionCounter &transitions, ColocationJoin *colocation) {
+  MemoryLedger::current().reset();
+  if (opt.memoryBudget > 0) {
+    analyseUserOutOfCore(opt, idx, log, transitions, colocation); // rows are streamed, and not kept in an arena
+  } else {
+    ArenaScope scope(arena);
+    analyseUser(opt, idx, log, transitions, colocation);
+  }
+  usage.stages = MemoryLedger::current();
+  usage.arenaHighWater = arena.highWater();
+  RunMetrics &metrics = RunMetrics::global();
+  struct stat st;
+  if (stat(opt.dataFiles[idx].c_str(), &st) == 0) metrics.add(metrics.bytesIn, st.st_size);
+  metrics.raise(metrics.peakBytes, usage.requiredBytes());
+  metrics.add(metrics.usersDone, 1);
+  if (opt.verbose) {
+    if (opt.memoryBudget == 0) {
+      log << "\nArena high-water mark: " << arena.highWater() << " bytes (" << arena.capacity() << " bytes reserved)" << std::endl;
+      if (opt.hugePages)
+        log << "Huge pages: " << arena.explicitHugePageBytes() << " bytes explicit, "
+            << arena.transparentHugePageBytes() << " bytes advised for transparent huge pages" << std::endl;
+    }
+    log << "Peak live bytes by stage:";
+    for (int a = 0; a < MEMORY_ACCOUNTS; a++) log << " " << MemoryLedger::name(a) << " " << usage.stages.peak(a);
+    log << ", total " << usage.stages.totalPeak() << std::endl;
+  }
+  arena.reset();
+}
+
+/**
+ * Write memory.json to the output directory: the peak RSS of the process, and for each user the bytes required
+ * to size a worker, the arena high-water mark, and the peak live bytes, in total and by stage.
+ */
+void writeMemorySummary(const Options &opt, std::vector<MemoryUsage> &usage) {
+  json summary;
+  summary["peak_rss_bytes"] = MemoryLedger::peakRSS();
+  summary["threads"] = opt.threads;
+  summary["users"] = json::array();
+  for (int i = 0; i < usage.size(); i++) {
+    json user;
+    user["file"] = opt.dataFiles[i];
+    user["arena_high_water_bytes"] = usage[i].arenaHighWater;
+    user["required_bytes"] = usage[i].requiredBytes();
+    user["peak_live_bytes"] = usage[i].stages.totalPeak();
+    for (int a = 0; a < MEMORY_ACCOUNTS; a++) user["stage_peak_live_bytes"][MemoryLedger::name(a)] = usage[i].stages.peak(a);
+    summary["users"].push_back(user);
+  }
+  std::string prefix = opt.outputDir == "." ? "" : opt.outputDir + "/";
+  std::ofstream ofs(prefix + "memory.json");
+  ofs << summary.dump(2) << std::endl;
+}
+
+/**
+ * Analyse every data file of opt as a user, and print their results to out.
+ * With several data files, up to opt.threads users are analysed in parallel, and their results are printed in order.
+ * The memory used by each user is recorded in usage.
+ * With the transitions output, each worker counts the cell transitions of its users on its own,
+ * and their counts are merged into population-transitions.csv once the workers are done.
+ * With the co-location output, the workers add the visits of their users to a ColocationJoin,
+ * which is run once the workers are done and written to colocation.csv.
+ */
+void analyseBatch(const Options &opt, std::ostream &out, std::vector<MemoryUsage> &usage) {
+  usage.assign(opt.dataFiles.size(), MemoryUsage());
+  RunMetrics::global().users = opt.dataFiles.size();
+  if (opt.dataFiles.size() == 1) {
+    Arena arena(1 << 20, opt.hugePages);
+    TransitionCounter transitions;
+    if (opt.outputs & OUTPUT_COLOCATION)
+      out << "WARNING: The colocation output needs at least two data files, and is skipped." << std::endl;
+    analyseUser(opt, 0, out, arena, usage[0], transitions, nullptr); // no other user to be co-located with
+    return;
+  }
+  std::string prefix = opt.outputDir == "." ? "" : opt.outputDir + "/";
+  std::unique_ptr<ColocationJoin> colocation;
+  if (opt.outputs & OUTPUT_COLOCATION)
+    colocation.reset(new ColocationJoin(opt.tolerance, opt.memoryBudget > 0 ? opt.memoryBudget : 256L << 20,
+                                        prefix + "colocation-spill-"));
+
+  std::vector<std::stringstream> logs(opt.dataFiles.size());
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  std::vector<TransitionCounter> transitions(std::min(opt.threads, (int)opt.dataFiles.size()));
+  for (int t = 0; t < opt.threads && t < opt.dataFiles.size(); t++) {
+    workers.push_back(std::thread([&, t]() {
+      PROFILE_THREAD("worker " + std::to_string(t + 1));
+      Arena arena(1 << 20, opt.hugePages); // one arena per worker
+      for (int i = next++; i < opt.dataFiles.size(); i = next++)
+        analyseUser(opt, i, logs[i], arena, usage[i], transitions[t], colocation.get());
+    }));
+  }
+  for (std::thread &w : workers) w.join();
+
+  if (opt.outputs & OUTPUT_TRANSITIONS) {
+    PROFILE_STAGE("population transitions");
+    for (int t = 1; t < transitions.size(); t++) transitions[0].add(transitions[t]);
+    transitions[0].matrix().write(prefix + "population-transitions.csv");
+  }
+
+  for (int i = 0; i < opt.dataFiles.size(); i++) {
+    out << "\nUser: " << opt.dataFiles[i] << std::endl;
+    out << logs[i].str();
+  }
+
+  if (colocation) {
+    std::map<std::pair<int, int>, Colocation> pairs = colocation->run(opt.threads);
+    std::ofstream ofs(prefix + "colocation.csv");
+    ofs << "user_a,user_b,count,overlap_seconds" << std::endl;
+    for (std::pair<const std::pair<int, int>, Colocation> &p : pairs)
+      ofs << opt.dataFiles[p.first.first] << "," << opt.dataFiles[p.first.second] << "," << p.second.count << ","
+          << p.second.overlap << "\n";
+    countBytesWritten(ofs.tellp());
+    ofs.close();
+    out << "\nCo-location: " << pairs.size() << " pairs of users within " << opt.tolerance << " seconds";
+    if (colocation->spilledBytes() > 0) out << ", " << colocation->spilledBytes() << " bytes of visits spilled";
+    out << std::endl;
+  }
+}
@@ -0,0 +1,273 @@
+#include "csv_parser.h"         // used for csv parsing
+#include "haversine_formula.h"  // used for calculating the great-circle distance
+#include "user.h"
+#include "benchmark.h"          // used for timing and summarizing the benchmarks
+#include <unistd.h>
+#include <sys/stat.h>
+
+// CSVRow::readNextRow before it reused the strings of the previous row, kept as the reference implementation
+class ReferenceCSVRow {
+public:
+  std::string const& operator[](std::size_t index) const { return m_data[index]; }
+  void readNextRow(std::istream& str) {
+    std::string         line;
+    std::getline(str, line);
+
+    std::stringstream   lineStream(line);
+    std::string         cell;
+
+    m_data.clear();
+    while (std::getline(lineStream, cell, '\t')) {
+      m_data.push_back(cell);
+    }
+  }
+private:
+  std::vector<std::string>    m_data;
+};
+
+// the data file, parsed once for the benchmarks of the later stages
+struct BenchInput {
+  std::string text;                    // the whole file
+  std::vector<std::string> timestamps; // first column of each row
+  ROWLIST rows;                        // sorted by time, the rows of the top 3 cells labelled as areas 1 to 3
+  std::vector<Cell> cells;
+  int areaCount;
+};
+
+void loadInput(std::string filename, BenchInput &in) {
+  std::ifstream dataSource(filename);
+  if (!dataSource) {
+    std::cout << "ERROR: The file cannot be opened." << std::endl;
+    exit(0);
+  }
+  std::stringstream ss;
+  ss << dataSource.rdbuf();
+  in.text = ss.str();
+
+  std::istringstream text(in.text);
+  CSVRow row;
+  text >> row; // skip the first line
+  while (text >> row) {
+    if (row.size() < 4) continue;
+    tm tm = {};
+    parseDateTime(row[0], tm);
+    in.timestamps.push_back(row[0]);
+    in.rows.push_back(DataRow(tm, stod(row[1]), stod(row[2]), row[3]));
+  }
+  sort(in.rows.begin(), in.rows.end(), compareByTime());
+
+  TAGMAP cellMap;
+  for (DataRow &d : in.rows) {
+    int &idx = cellMap[d.getTag()];
+    if (in.cells.size() < cellMap.size()) {
+      idx = in.cells.size();
+      in.cells.push_back(Cell(d.getTag()));
+    }
+    in.cells[idx].addDataRow(d);
+  }
+  std::vector<int> order(in.cells.size());
+  for (int i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return in.cells[a].numConnections() > in.cells[b].numConnections(); });
+  in.areaCount = std::min(3, (int)order.size());
+  for (int a = 0; a < in.areaCount; a++) {
+    const ArenaString &tag = in.cells[order[a]].getName();
+    for (DataRow &d : in.rows) {
+      if (d.getTag() == tag) d.setAreaID(a + 1);
+    }
+  }
+}
+
+// sums the speed between consecutive rows, a scan bound by the memory of the rows and the pair columns
+class PairSpeedKernel : public ScanKernel {
+public:
+  double sum;
+  int needs() { return SCAN_PAIR; };
+  void begin() { sum = 0; };
+  void visit(const ScanRow &r) {
+    if (r.pairTimeDiff > 0) sum += r.pairDistance / r.pairTimeDiff + r.row->getLat();
+  };
+};
+
+void printUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options] [data file]" << std::endl;
+  std::cout << "Microbenchmarks of the core kernels on a data file (default: data.csv)." << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  -r <reps>      timed repetitions of each benchmark (default: 20)" << std::endl;
+  std::cout << "  -w <reps>      warmup repetitions of each benchmark (default: 3)" << std::endl;
+  std::cout << "  -f <filter>    only run the benchmarks whose name contains <filter>" << std::endl;
+  std::cout << "  -o <file>      write the results as json to <file>" << std::endl;
+  std::cout << "  -d <dir>       directory of the files written by the benchmarks (default: bench-scratch)" << std::endl;
+  std::cout << "  -h             show this message" << std::endl;
+}
+
+/**
+ * Main function:
+ * Parse the command line, load the data file, then run each benchmark with its variants side by side.
+ * @returns 0 on exit
+ */
+int main(int argc, char *argv[]) {
+  int reps = 20, warmup = 3;
+  std::string filter, jsonFile, dir = "bench-scratch", dataFile = "data.csv";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (arg.size() == 2 && arg[0] == '-') {
+      if (std::string("rwfod").find(arg[1]) == std::string::npos || i + 1 >= argc) {
+        std::cout << "ERROR: Invalid option " << arg << "." << std::endl;
+        printUsage(argv[0]);
+        return 0;
+      }
+      std::string value = argv[++i];
+      switch (arg[1]) {
+        case 'r': reps = std::max(1, atoi(value.c_str())); break;
+        case 'w': warmup = std::max(0, atoi(value.c_str())); break;
+        case 'f': filter = value; break;
+        case 'o': jsonFile = value; break;
+        case 'd': dir = value; break;
+      }
+    } else {
+      dataFile = arg;
+    }
+  }
+
+  BenchInput in;
+  loadInput(dataFile, in);
+  long n = in.rows.size();
+  std::cout << "Data: " << dataFile << ", " << n << " rows, " << in.cells.size() << " cells" << std::endl;
+  char cwd[4096];
+  std::string jsonPath = jsonFile.empty() || jsonFile[0] == '/' || !getcwd(cwd, sizeof(cwd)) ? jsonFile : std::string(cwd) + "/" + jsonFile;
+  mkdir(dir.c_str(), 0755);
+  if (chdir(dir.c_str()) != 0) {
+    std::cout << "ERROR: The directory " << dir << " cannot be used." << std::endl;
+    return 0;
+  }
+
+  // the reference functions print to std::cout; silence them while timing
+  std::ofstream devNull("/dev/null");
+  std::streambuf *coutBuf = std::cout.rdbuf(devNull.rdbuf());
+  BenchmarkRunner bench(warmup, reps, filter);
+
+  bench.run("csv.readNextRow", "reference", n, [&]() {
+    std::istringstream text(in.text);
+    ReferenceCSVRow row;
+    for (row.readNextRow(text); text; row.readNextRow(text)) benchSink = benchSink + row[3].size();
+  });
+  bench.run("csv.readNextRow", "reuse", n, [&]() {
+    std::istringstream text(in.text);
+    CSVRow row;
+    for (row.readNextRow(text); text; row.readNextRow(text)) benchSink = benchSink + row[3].size();
+  });
+
+  bench.run("parseDateTime", "get_time", n, [&]() {
+    for (std::string &s : in.timestamps) {
+      tm tm = {};
+      std::stringstream ss(s);
+      ss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+      benchSink = benchSink + tm.tm_sec;
+    }
+  });
+  bench.run("parseDateTime", "strptime", n, [&]() {
+    for (std::string &s : in.timestamps) {
+      tm tm = {};
+      parseDateTime(s, tm);
+      benchSink = benchSink + tm.tm_sec;
+    }
+  });
+
+  bench.run("getTimeValue", "mktime", n, [&]() {
+    for (DataRow &d : in.rows) benchSink = benchSink + getTimeValue(d.getDateTime());
+  });
+
+  bench.run("distanceEarth", "haversine", n, [&]() {
+    for (long i = 1; i < n; i++)
+      benchSink = benchSink + distanceEarth(in.rows[i - 1].getLat(), in.rows[i - 1].getLon(), in.rows[i].getLat(), in.rows[i].getLon());
+  });
+
+  bench.run("getTimeSegments", "all cells", n, [&]() {
+    for (Cell &c : in.cells) benchSink = benchSink + c.getTimeSegments(180).size();
+  });
+
+  std::vector<SEGMENTLIST> segments;
+  for (Cell &c : in.cells) segments.push_back(c.getTimeSegments(180));
+  std::sort(segments.begin(), segments.end(), [](const SEGMENTLIST &a, const SEGMENTLIST &b) { return a.size() > b.size(); });
+  if (segments.size() >= 2) {
+    bench.run("merge", "top 2 cells", segments[0].size() + segments[1].size(), [&]() {
+      benchSink = benchSink + merge(segments[0], segments[1]).size();
+    });
+  }
+
+  bench.run("centerOfGravity", "reference", n * in.areaCount, [&]() {
+    for (int a = 1; a <= in.areaCount; a++) benchSink = benchSink + centerOfGravity(in.rows, a)[0];
+  });
+  bench.run("centerOfGravity", "graph cold", n * in.areaCount, [&]() {
+    AnalysisGraph graph(in.rows);
+    graph.setAreaLabeler([](DataRow &r) { return r.getAreaID(); });
+    for (int a = 1; a <= in.areaCount; a++) benchSink = benchSink + centerOfGravity(graph, a, nullptr)[0];
+  });
+  AnalysisGraph warmGraph(in.rows);
+  warmGraph.setAreaLabeler([](DataRow &r) { return r.getAreaID(); });
+  bench.run("centerOfGravity", "graph warm", n * in.areaCount, [&]() {
+    for (int a = 1; a <= in.areaCount; a++) benchSink = benchSink + centerOfGravity(warmGraph, a, nullptr)[0];
+  });
+
+  // the same scan over rows and columns held in an arena on normal pages, then in one on huge pages (as with -H)
+  for (int hugePages = 0; hugePages < 2 && bench.selected("scan"); hugePages++) {
+    Arena arena(1 << 20, hugePages);
+    ArenaScope scope(arena);
+    ROWLIST rows(in.rows.begin(), in.rows.end());
+    AnalysisGraph graph(rows);
+    graph.pairTimeDiff();
+    graph.pairDistance();
+    ScanEngine engine;
+    PairSpeedKernel kernel;
+    engine.add(&kernel);
+    bench.run("scan", hugePages ? "huge pages" : "normal pages", n, [&]() {
+      engine.run(graph);
+      benchSink = benchSink + kernel.sum;
+    });
+  }
+
+  bench.run("midpointAnalysis", "reference", n * in.areaCount, [&]() {
+    midpointAnalysis(in.rows, in.areaCount, false);
+  });
+  bench.run("midpointAnalysis", "graph cold", n * in.areaCount, [&]() {
+    AnalysisGraph graph(in.rows);
+    graph.setAreaLabeler([](DataRow &r) { return r.getAreaID(); });
+    midpointAnalysis(graph, in.areaCount, false, nullptr, "graph-", true);
+  });
+
+  NextLocationIndex nextLocation;
+  std::vector<std::string> tags;
+  for (DataRow &d : in.rows) tags.push_back(std::string(d.getTag().data(), d.getTag().size()));
+  bench.run("nextLocationBuild", "index", n, [&]() {
+    NextLocationIndex index;
+    for (long i = 0; i < n; i++) index.add(tags[i], in.rows[i].getAreaID(), in.rows[i].getDateTime());
+    benchSink = benchSink + index.numContexts();
+  });
+  for (long i = 0; i < n; i++) nextLocation.add(tags[i], in.rows[i].getAreaID(), in.rows[i].getDateTime());
+  bench.run("nextLocationPredict", "top 3", n, [&]() {
+    Prediction next[3];
+    for (long i = 0; i < n; i++) benchSink = benchSink + nextLocation.predict(tags[i], in.rows[i].getDateTime(), next);
+  });
+
+  std::vector<double> coords;
+  for (DataRow &d : in.rows) {
+    coords.push_back(d.getLon());
+    coords.push_back(d.getLat());
+  }
+  bench.run("createJsonFile", "rows", n, [&]() { createJsonFile("map-rows.json", in.rows, 0, n); });
+  bench.run("createJsonFile", "coords", n, [&]() { createJsonFile("map-coords.json", coords); });
+
+  std::cout.rdbuf(coutBuf);
+  bench.print(std::cout);
+  if (!jsonPath.empty()) {
+    json doc = bench.toJson();
+    doc["data"] = {{"file", dataFile}, {"rows", n}, {"cells", in.cells.size()}};
+    std::ofstream ofs(jsonPath);
+    ofs << doc.dump(2) << std::endl;
+  }
+  return 0;
+}
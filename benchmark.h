@@ -0,0 +1,126 @@
+/**
+ * @file
+ * @brief Harness of the microbenchmarks.
+ * @details
+ * A BenchmarkRunner times a body a number of times after a few warmup runs, and summarizes the repetitions
+ * (min, median, mean, standard deviation, 90th percentile and throughput of items).
+ * Variants of the same benchmark (e.g. the reference implementation and an optimized one) share its name,
+ * so they are printed side by side, with the speedup of each variant over the first one.
+ * The performance counters of the repetitions (see PerfCounters) are printed per item next to the times:
+ * instructions per cycle, cache and branch miss rates, instructions and page faults. Counters the machine
+ * does not offer are printed as n/a.
+ */
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+
+// results feed this sink, so the compiler cannot drop the work of a benchmark body
+volatile double benchSink = 0;
+
+struct BenchStats {
+  std::string name;
+  std::string variant;
+  int reps;
+  long items;    // items (e.g. rows) processed by one repetition
+  double min;    // seconds
+  double median;
+  double mean;
+  double stddev;
+  double p90;
+  double counters[PERF_COUNTERS]; // per repetition, -1 if not available
+  std::vector<double> samples;    // time of each repetition, sorted
+};
+
+class BenchmarkRunner {
+private:
+  int warmup_;
+  int reps_;
+  std::string filter_; // only benchmarks whose name contains filter_ are run
+  std::vector<BenchStats> results_;
+  PerfCounters perf_;
+
+public:
+  BenchmarkRunner(int warmup, int reps, std::string filter) : warmup_(warmup), reps_(reps), filter_(filter) {};
+  bool selected(const std::string &name) { return name.find(filter_) != std::string::npos; };
+  void run(std::string name, std::string variant, long items, std::function<void()> body);
+  void print(std::ostream &out);
+  json toJson();
+};
+
+void BenchmarkRunner::run(std::string name, std::string variant, long items, std::function<void()> body) {
+  if (!selected(name)) return;
+  for (int i = 0; i < warmup_; i++) body();
+  std::vector<double> times;
+  double before[PERF_COUNTERS], after[PERF_COUNTERS];
+  perf_.read(before);
+  for (int i = 0; i < reps_; i++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    body();
+    times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  perf_.read(after);
+  std::sort(times.begin(), times.end());
+  BenchStats s = {};
+  s.name = name;
+  s.variant = variant;
+  s.reps = reps_;
+  s.items = items;
+  s.min = times.front();
+  s.samples = times;
+  for (int c = 0; c < PERF_COUNTERS; c++) s.counters[c] = before[c] < 0 || after[c] < 0 ? -1 : (after[c] - before[c]) / reps_;
+  int n = times.size();
+  s.median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+  s.p90 = times[std::min(n - 1, (int)ceil(0.9 * n) - 1)];
+  for (double t : times) s.mean += t / n;
+  for (double t : times) s.stddev += (t - s.mean) * (t - s.mean);
+  s.stddev = n > 1 ? sqrt(s.stddev / (n - 1)) : 0;
+  results_.push_back(s);
+}
+
+void BenchmarkRunner::print(std::ostream &out) {
+  out << std::left << std::setw(24) << "benchmark" << std::setw(16) << "variant" << std::right
+      << std::setw(12) << "median us" << std::setw(12) << "min us" << std::setw(12) << "stddev us"
+      << std::setw(12) << "ns/item" << std::setw(10) << "speedup" << std::endl;
+  for (int i = 0; i < results_.size(); i++) {
+    BenchStats &s = results_[i];
+    int first = i;
+    while (first > 0 && results_[first - 1].name == s.name) first--;
+    out << std::left << std::setw(24) << s.name << std::setw(16) << s.variant << std::right << std::fixed
+        << std::setprecision(1) << std::setw(12) << s.median * 1e6 << std::setw(12) << s.min * 1e6
+        << std::setw(12) << s.stddev * 1e6 << std::setw(12) << (s.items > 0 ? s.median * 1e9 / s.items : 0)
+        << std::setprecision(2) << std::setw(9) << results_[first].median / s.median << "x" << std::endl;
+  }
+  out.unsetf(std::ios::fixed);
+
+  out << std::endl << std::left << std::setw(24) << "counters" << std::setw(16) << "variant" << std::right
+      << std::setw(8) << "IPC" << std::setw(14) << "cache miss %" << std::setw(15) << "branch miss %"
+      << std::setw(13) << "instr/item" << std::setw(13) << "faults/rep" << std::endl;
+  for (BenchStats &s : results_) {
+    const double *c = s.counters;
+    out << std::left << std::setw(24) << s.name << std::setw(16) << s.variant << std::right
+        << std::setw(8) << perfRatio(c[PERF_INSTRUCTIONS], c[PERF_CYCLES], 1)
+        << std::setw(14) << perfRatio(c[PERF_CACHE_MISSES], c[PERF_CACHE_REFERENCES], 100)
+        << std::setw(15) << perfRatio(c[PERF_BRANCH_MISSES], c[PERF_BRANCHES], 100)
+        << std::setw(13) << perfRatio(c[PERF_INSTRUCTIONS], s.items, 1)
+        << std::setw(13) << perfRatio(c[PERF_PAGE_FAULTS], 1, 1) << std::endl;
+  }
+  if (!perf_.error().empty()) out << "Some counters are not available (" << perf_.error() << ")." << std::endl;
+}
+
+json BenchmarkRunner::toJson() {
+  json doc;
+  doc["warmup"] = warmup_;
+  doc["repetitions"] = reps_;
+  doc["benchmarks"] = json::array();
+  for (BenchStats &s : results_) {
+    doc["benchmarks"].push_back({{"name", s.name}, {"variant", s.variant}, {"items", s.items},
+                                 {"min_s", s.min}, {"median_s", s.median}, {"mean_s", s.mean},
+                                 {"stddev_s", s.stddev}, {"p90_s", s.p90}, {"samples_s", s.samples},
+                                 {"items_per_s", s.median > 0 ? s.items / s.median : 0}});
+    json &counters = doc["benchmarks"].back()["counters"];
+    for (int c = 0; c < PERF_COUNTERS; c++) counters[PerfCounters::name(c)] = s.counters[c] < 0 ? json() : json(s.counters[c]);
+  }
+  if (!perf_.error().empty()) doc["counters_error"] = perf_.error();
+  return doc;
+}
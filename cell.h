@@ -8,20 +8,21 @@
 
 class Cell {
 private:  
-  std::string tag_;
-  std::vector<DataRow> rowList_;
+  ArenaString tag_;
+  ROWLIST rowList_;
 
 public:
-  Cell(DataRow r, std::string tag) {
+  Cell(const DataRow &r, const ArenaString &tag) : tag_(tag) {
     rowList_.push_back(r);
-    tag_ = tag;
   };
-  void addDataRow(DataRow d) { rowList_.push_back(d); };
+  Cell(const ArenaString &tag) : tag_(tag) {};
+  void addDataRow(const DataRow &d) { rowList_.push_back(d); };
+  void reserve(int n) { rowList_.reserve(n); };
   int numConnections() { return rowList_.size(); };
   bool isWithinInterval(int i, int j, int interval);
-  std::vector<TIMEPAIR> getTimeSegments(int interval);
-  std::string getName() { return tag_; };
-  std::vector<DataRow>& getRowList() { return rowList_; };
+  SEGMENTLIST getTimeSegments(int interval);
+  const ArenaString& getName() { return tag_; };
+  ROWLIST& getRowList() { return rowList_; };
 };
 
 /**
@@ -39,8 +40,8 @@ bool Cell::isWithinInterval(int i, int j, int interval) {
   return difftime(getTimeValue(rowList_[j].getDateTime()), getTimeValue(rowList_[i].getDateTime())) <= interval;
 }
 
-std::vector<TIMEPAIR> Cell::getTimeSegments(int interval) {
-  std::vector<TIMEPAIR> segmentList;
+SEGMENTLIST Cell::getTimeSegments(int interval) {
+  SEGMENTLIST segmentList;
   TIMEPAIR segment;
   int low = 0, high = 0;
   segment.first = rowList_[0].getDateTime();
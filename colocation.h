@@ -0,0 +1,310 @@
+/**
+ * @file
+ * @brief Co-location join: the pairs of users seen on the same cell at the same time, within a tolerance.
+ * @details
+ * The ColocationKernel turns the rows of a user into visits: consecutive rows on the same cell, less than the
+ * tolerance apart, make one visit [start, end]. Two visits of different users on the same cell are co-located
+ * if [start, end + tolerance] of each overlap; their overlap duration is that of [start, end].
+ * The ColocationJoin partitions the visits of all users by (cell, hour bucket): a visit is copied into every
+ * bucket that [start, end + tolerance] touches, and a co-located pair is only counted in the bucket of the later
+ * start, which both visits reach, so each pair is counted once without comparing visits of different buckets.
+ * Buckets are hashed into partitions. The workers of the batch add visits to the partitions in parallel, one lock
+ * per partition; when the partitions hold more than the memory budget, the partition being added to is spilled
+ * to its file. Once every user has been added, run joins the partitions in parallel: each is read back, sorted by
+ * (cell, bucket, start), and swept with a window of the visits still open, so only co-located pairs are compared.
+ * A partition larger than the share of the budget of a join worker is first split into sub-partitions on disk by
+ * another hash of (cell, bucket), recursively, so a join only loads what fits unless one (cell, bucket) does not.
+ * Each worker counts its pairs on its own, and the counts are merged at the end.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+struct Visit {
+  int cell;
+  int user;
+  int bucket;     // hour bucket of this copy of the visit
+  int pad;
+  long long start; // seconds of the first row, taken as UTC
+  long long end;   // seconds of the last row
+};
+
+struct Colocation {
+  long count;      // co-located visits
+  double overlap;  // seconds both users were on the same cell
+};
+
+class ColocationJoin {
+private:
+  struct Partition {
+    int id;
+    std::mutex mutex;
+    std::vector<Visit> visits;
+    std::string spillFile;
+    long spilled; // visits in spillFile
+  };
+
+  int tolerance_;
+  size_t memoryBudget_;
+  std::string spillPrefix_;
+  std::vector<std::unique_ptr<Partition> > partitions_;
+  std::atomic<long> bufferBytes_;
+  std::atomic<long> spilledBytes_;
+  std::mutex cellMutex_;
+  std::unordered_map<std::string, int> cellIDs_;
+
+  static const int BUCKET_SECONDS = 3600;
+  static const int MAX_SPLITS = 4;     // levels of sub-partitions
+  static const int MAX_FAN_OUT = 64;   // sub-partitions of a split
+  size_t partitionOf(int cell, int bucket) {
+    return ((size_t)cell * 1000003 + bucket) % partitions_.size();
+  };
+  // @returns the sub-partition of (cell, bucket) among k at a level of splits, independent of partitionOf
+  static size_t subPartitionOf(const Visit &v, int level, int k) {
+    unsigned long long h = ((unsigned long long)v.cell * 1000003 + v.bucket) ^ ((unsigned long long)level << 40);
+    return (h * 0x9e3779b97f4a7c15ULL >> 32) % k;
+  };
+  void spill(Partition &p);
+  void split(Partition &p, std::unordered_map<unsigned long long, Colocation> &pairs, size_t limit, int level);
+  void join(Partition &p, std::unordered_map<unsigned long long, Colocation> &pairs, size_t limit, int level);
+
+public:
+  ColocationJoin(int tolerance, size_t memoryBudget, std::string spillPrefix, int partitions = 64) :
+    tolerance_(tolerance), memoryBudget_(memoryBudget), spillPrefix_(spillPrefix), bufferBytes_(0), spilledBytes_(0) {
+    for (int i = 0; i < partitions; i++) {
+      partitions_.push_back(std::unique_ptr<Partition>(new Partition()));
+      partitions_.back()->id = i;
+      partitions_.back()->spilled = 0;
+    }
+  };
+  ~ColocationJoin() {
+    for (std::unique_ptr<Partition> &p : partitions_) {
+      if (!p->spillFile.empty()) remove(p->spillFile.c_str());
+    }
+  };
+  int tolerance() { return tolerance_; };
+  int cellID(const std::string &tag) {
+    std::lock_guard<std::mutex> lock(cellMutex_);
+    return cellIDs_.insert(std::make_pair(tag, (int)cellIDs_.size())).first->second;
+  };
+  void add(const std::vector<Visit> &visits);
+  std::map<std::pair<int, int>, Colocation> run(int threads);
+  long spilledBytes() { return spilledBytes_; };
+};
+
+// copy each visit into the buckets it reaches and add the copies to their partitions
+void ColocationJoin::add(const std::vector<Visit> &visits) {
+  std::vector<std::vector<Visit> > parts(partitions_.size());
+  for (const Visit &v : visits) {
+    Visit copy = v;
+    for (long long b = v.start / BUCKET_SECONDS; b <= (v.end + tolerance_) / BUCKET_SECONDS; b++) {
+      copy.bucket = b;
+      parts[partitionOf(copy.cell, copy.bucket)].push_back(copy);
+    }
+  }
+  for (int i = 0; i < parts.size(); i++) {
+    if (parts[i].empty()) continue;
+    Partition &p = *partitions_[i];
+    std::lock_guard<std::mutex> lock(p.mutex);
+    p.visits.insert(p.visits.end(), parts[i].begin(), parts[i].end());
+    if ((bufferBytes_ += parts[i].size() * sizeof(Visit)) > memoryBudget_) spill(p);
+  }
+}
+
+// append the visits of p to its file; the caller holds the lock of p
+void ColocationJoin::spill(Partition &p) {
+  PROFILE_STAGE("spill");
+  PROFILE_ROWS(p.visits.size());
+  if (p.spillFile.empty()) p.spillFile = spillPrefix_ + std::to_string(p.id) + ".visits";
+  FILE *file = fopen(p.spillFile.c_str(), "ab");
+  if (!file) {
+    std::cout << "ERROR: The spill file " << p.spillFile << " cannot be created." << std::endl;
+    exit(0);
+  }
+  fwrite(p.visits.data(), sizeof(Visit), p.visits.size(), file);
+  fclose(file);
+  PROFILE_BYTES(p.visits.size() * sizeof(Visit));
+  p.spilled += p.visits.size();
+  bufferBytes_ -= p.visits.size() * sizeof(Visit);
+  spilledBytes_ += p.visits.size() * sizeof(Visit);
+  std::vector<Visit>().swap(p.visits);
+}
+
+/**
+ * Split the visits of p, spilled and in memory, into sub-partitions written to files next to its file,
+ * by the sub-partition of their (cell, bucket) at level, and join each of them within limit bytes.
+ * A split sending every visit to one sub-partition (e.g. a single busy cell and hour) is not split again.
+ */
+void ColocationJoin::split(Partition &p, std::unordered_map<unsigned long long, Colocation> &pairs, size_t limit, int level) {
+  PROFILE_STAGE("split");
+  long total = p.spilled + p.visits.size();
+  int k = (int)std::min((size_t)MAX_FAN_OUT, 2 * total * sizeof(Visit) / limit + 1);
+  std::vector<std::unique_ptr<Partition> > subs;
+  std::vector<FILE *> files;
+  for (int i = 0; i < k; i++) {
+    subs.push_back(std::unique_ptr<Partition>(new Partition()));
+    subs[i]->id = i;
+    subs[i]->spillFile = p.spillFile + "." + std::to_string(i);
+    subs[i]->spilled = 0;
+    files.push_back(fopen(subs[i]->spillFile.c_str(), "wb"));
+    if (!files[i]) {
+      std::cout << "ERROR: The spill file " << subs[i]->spillFile << " cannot be created." << std::endl;
+      exit(0);
+    }
+  }
+  auto route = [&](const Visit &v) {
+    size_t s = subPartitionOf(v, level, k);
+    fwrite(&v, sizeof(Visit), 1, files[s]);
+    subs[s]->spilled++;
+  };
+  std::vector<Visit> block(std::max((size_t)1, limit / 2 / sizeof(Visit)));
+  FILE *file = fopen(p.spillFile.c_str(), "rb");
+  if (!file) {
+    std::cout << "ERROR: The spill file " << p.spillFile << " cannot be read." << std::endl;
+    exit(0);
+  }
+  for (size_t n; (n = fread(block.data(), sizeof(Visit), block.size(), file)) > 0;) {
+    for (size_t i = 0; i < n; i++) route(block[i]);
+  }
+  fclose(file);
+  remove(p.spillFile.c_str());
+  for (const Visit &v : p.visits) route(v);
+  std::vector<Visit>().swap(p.visits);
+  std::vector<Visit>().swap(block);
+  for (FILE *f : files) fclose(f);
+  PROFILE_ROWS(total);
+  PROFILE_BYTES(total * sizeof(Visit));
+  spilledBytes_ += total * sizeof(Visit);
+
+  for (std::unique_ptr<Partition> &sub : subs) {
+    join(*sub, pairs, limit, sub->spilled == total ? MAX_SPLITS : level + 1);
+    remove(sub->spillFile.c_str());
+  }
+}
+
+/**
+ * Count the co-located pairs of the visits of p into pairs, by the key user a << 32 | user b with a < b.
+ * If p holds more than limit bytes of visits, some of them spilled, it is split first, up to MAX_SPLITS levels.
+ */
+void ColocationJoin::join(Partition &p, std::unordered_map<unsigned long long, Colocation> &pairs, size_t limit, int level) {
+  if (p.spilled > 0 && (p.spilled + p.visits.size()) * sizeof(Visit) > limit && level < MAX_SPLITS) {
+    split(p, pairs, limit, level);
+    return;
+  }
+  std::vector<Visit> visits;
+  if (p.spilled > 0) {
+    visits.reserve(p.spilled + p.visits.size());
+    visits.resize(p.spilled);
+    FILE *file = fopen(p.spillFile.c_str(), "rb");
+    if (!file || fread(visits.data(), sizeof(Visit), p.spilled, file) != p.spilled) {
+      std::cout << "ERROR: The spill file " << p.spillFile << " cannot be read." << std::endl;
+      exit(0);
+    }
+    fclose(file);
+    visits.insert(visits.end(), p.visits.begin(), p.visits.end());
+    std::vector<Visit>().swap(p.visits);
+  } else {
+    visits.swap(p.visits); // nothing to read back, and no copy of the visits in memory
+  }
+  PROFILE_ROWS(visits.size());
+  std::sort(visits.begin(), visits.end(), [](const Visit &a, const Visit &b) {
+    if (a.cell != b.cell) return a.cell < b.cell;
+    if (a.bucket != b.bucket) return a.bucket < b.bucket;
+    return a.start < b.start;
+  });
+
+  std::vector<const Visit *> open; // visits of the current cell and bucket that may still be co-located
+  for (size_t i = 0; i < visits.size(); i++) {
+    const Visit &v = visits[i];
+    if (i == 0 || v.cell != visits[i - 1].cell || v.bucket != visits[i - 1].bucket) open.clear();
+    size_t kept = 0;
+    for (const Visit *o : open) {
+      if (o->end + tolerance_ < v.start) continue; // closed before v started
+      open[kept++] = o;
+      // counted in the bucket of the later start only; v starts no earlier than o
+      if (o->user == v.user || v.start / BUCKET_SECONDS != v.bucket) continue;
+      Colocation &c = pairs[(unsigned long long)std::min(o->user, v.user) << 32 | std::max(o->user, v.user)];
+      c.count++;
+      c.overlap += std::max(0LL, std::min(o->end, v.end) - v.start);
+    }
+    open.resize(kept);
+    open.push_back(&v);
+  }
+}
+
+/**
+ * Join the partitions on up to threads workers, each within its share of the memory budget.
+ * @returns the co-located visits and the overlap duration of each pair of users seen together
+ */
+std::map<std::pair<int, int>, Colocation> ColocationJoin::run(int threads) {
+  PROFILE_STAGE("colocation join");
+  std::vector<std::unordered_map<unsigned long long, Colocation> > pairs(std::max(1, threads));
+  size_t limit = std::max(memoryBudget_ / pairs.size(), sizeof(Visit));
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < pairs.size(); t++) {
+    workers.push_back(std::thread([&, t]() {
+      PROFILE_THREAD("join " + std::to_string(t + 1));
+      for (int i = next++; i < partitions_.size(); i = next++) join(*partitions_[i], pairs[t], limit, 0);
+    }));
+  }
+  for (std::thread &w : workers) w.join();
+
+  std::map<std::pair<int, int>, Colocation> merged;
+  for (std::unordered_map<unsigned long long, Colocation> &local : pairs) {
+    for (std::pair<const unsigned long long, Colocation> &e : local) {
+      Colocation &c = merged[std::make_pair((int)(e.first >> 32), (int)(e.first & 0xffffffffULL))];
+      c.count += e.second.count;
+      c.overlap += e.second.overlap;
+    }
+  }
+  return merged;
+}
+
+// collects the visits of a user for a ColocationJoin
+class ColocationKernel : public ScanKernel {
+private:
+  ColocationJoin *join_;
+  int user_;
+  std::vector<Visit> visits_;
+  std::string tag_; // cell of the last visit
+  std::unordered_map<std::string, int> cellIDs_; // cells of the user, to take the lock of the join once per cell
+
+public:
+  ColocationKernel(ColocationJoin *join, int user) : join_(join), user_(user) {};
+  void begin() {
+    visits_.clear();
+    cellIDs_.clear();
+  };
+  void visit(const ScanRow &r) {
+    tm datetime = r.row->getDateTime();
+    long long t = timegm(&datetime);
+    const ArenaString &tag = r.row->getTag();
+    bool sameCell = !visits_.empty() && tag_.compare(0, tag_.size(), tag.data(), tag.size()) == 0;
+    if (sameCell && t - visits_.back().end <= join_->tolerance()) {
+      visits_.back().end = t;
+      return;
+    }
+    int cell;
+    if (sameCell) {
+      cell = visits_.back().cell;
+    } else {
+      tag_.assign(tag.data(), tag.size());
+      std::unordered_map<std::string, int>::iterator it = cellIDs_.find(tag_);
+      cell = it != cellIDs_.end() ? it->second : (cellIDs_[tag_] = join_->cellID(tag_));
+    }
+    Visit v = {cell, user_, 0, 0, t, t};
+    visits_.push_back(v);
+  };
+  void end() {
+    PROFILE_STAGE("colocation visits");
+    PROFILE_ROWS(visits_.size());
+    join_->add(visits_);
+    std::vector<Visit>().swap(visits_);
+  };
+};
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "nlohmann/json.hpp"    // used for reading the reports
+
+using json = nlohmann::json;
+
+// time samples of each kernel or stage of a report, by its name
+typedef std::map<std::string, std::vector<double> > SAMPLEMAP;
+
+void addSamples(SAMPLEMAP &samples, const std::string &key, const json &values, const json &fallback) {
+  std::vector<double> &s = samples[key];
+  if (values.is_array()) {
+    for (const json &v : values) s.push_back(v);
+  } else if (fallback.is_number()) {
+    s.push_back(fallback); // a report written before the samples were recorded
+  }
+}
+
+/**
+ * Read the time samples of a report of the microbenchmarks (benchmark -o) or of the scaling benchmark (scaling -o).
+ * Kernels are named "name [variant]"; the runs of the scaling benchmark "days=N threads=T", and their stages
+ * (in a build with -DSTAGE_PROFILE) "days=N threads=T path/of/the/stage".
+ */
+SAMPLEMAP readReport(std::string filename) {
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    std::cout << "ERROR: The file " << filename << " cannot be opened." << std::endl;
+    exit(2);
+  }
+  json doc;
+  try {
+    ifs >> doc;
+  } catch (json::exception &e) {
+    std::cout << "ERROR: The file " << filename << " is not valid json." << std::endl;
+    exit(2);
+  }
+
+  SAMPLEMAP samples;
+  if (doc.count("benchmarks")) {
+    for (json &b : doc["benchmarks"]) {
+      std::string key = b.value("name", "") + " [" + b.value("variant", "") + "]";
+      addSamples(samples, key, b["samples_s"], b["median_s"]);
+    }
+  } else if (doc.count("runs")) {
+    for (json &r : doc["runs"]) {
+      std::string key = "days=" + std::to_string((int)r["days"]) + " threads=" + std::to_string((int)r["threads"]);
+      addSamples(samples, key, r["wall_samples_s"], r["wall_s"]);
+      if (!r.count("stage_samples_s")) continue;
+      for (json::iterator it = r["stage_samples_s"].begin(); it != r["stage_samples_s"].end(); ++it)
+        addSamples(samples, key + " " + it.key(), it.value(), json());
+    }
+  } else {
+    std::cout << "ERROR: The file " << filename << " is not a benchmark report." << std::endl;
+    exit(2);
+  }
+  return samples;
+}
+
+double median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  int n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// continued fraction of the incomplete beta function (modified Lentz's method)
+double betaFraction(double a, double b, double x) {
+  const double tiny = 1e-300;
+  double c = 1, d = 1 - (a + b) * x / (a + 1);
+  if (fabs(d) < tiny) d = tiny;
+  d = 1 / d;
+  double h = d;
+  for (int m = 1; m <= 300; m++) {
+    double aa = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+    d = 1 + aa * d;
+    if (fabs(d) < tiny) d = tiny;
+    c = 1 + aa / c;
+    if (fabs(c) < tiny) c = tiny;
+    d = 1 / d;
+    h *= d * c;
+    aa = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+    d = 1 + aa * d;
+    if (fabs(d) < tiny) d = tiny;
+    c = 1 + aa / c;
+    if (fabs(c) < tiny) c = tiny;
+    d = 1 / d;
+    double delta = d * c;
+    h *= delta;
+    if (fabs(delta - 1) < 1e-12) break;
+  }
+  return h;
+}
+
+// regularized incomplete beta function I_x(a, b)
+double incompleteBeta(double a, double b, double x) {
+  if (x <= 0) return 0;
+  if (x >= 1) return 1;
+  double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+  if (x < (a + 1) / (a + b + 2)) return front * betaFraction(a, b, x) / a;
+  return 1 - front * betaFraction(b, a, 1 - x) / b;
+}
+
+/**
+ * Welch's t-test of the means of two samples, which may differ in size and variance.
+ * @returns the two-sided p-value, or -1 if a sample has fewer than two values
+ */
+double welchTest(const std::vector<double> &a, const std::vector<double> &b) {
+  int na = a.size(), nb = b.size();
+  if (na < 2 || nb < 2) return -1;
+  double ma = 0, mb = 0, va = 0, vb = 0;
+  for (double x : a) ma += x / na;
+  for (double x : b) mb += x / nb;
+  for (double x : a) va += (x - ma) * (x - ma) / (na - 1);
+  for (double x : b) vb += (x - mb) * (x - mb) / (nb - 1);
+  double se2 = va / na + vb / nb;
+  if (se2 == 0) return ma == mb ? 1 : 0;
+  double t = (mb - ma) / sqrt(se2);
+  double df = se2 * se2 / ((va / na) * (va / na) / (na - 1) + (vb / nb) * (vb / nb) / (nb - 1));
+  return incompleteBeta(df / 2, 0.5, df / (df + t * t));
+}
+
+void printUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options] <baseline report> <new report>" << std::endl;
+  std::cout << "Compare the kernels (or runs and stages) of two reports of benchmark -o or scaling -o." << std::endl;
+  std::cout << "A kernel regresses if its median time grows by more than the threshold, and Welch's t-test finds" << std::endl;
+  std::cout << "the difference significant; with fewer than two samples on a side, the threshold alone decides." << std::endl;
+  std::cout << "Exits with 1 if any kernel regresses or is missing from the new report, 2 on an error or if no kernel" << std::endl;
+  std::cout << "is found in both reports, 0 otherwise." << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  -t <percent>   noise threshold of the change of the median (default: 5)" << std::endl;
+  std::cout << "  -a <alpha>     significance level of the test (default: 0.01)" << std::endl;
+  std::cout << "  -f <us>        ignore changes smaller than <us> microseconds (default: 0)" << std::endl;
+  std::cout << "  -h             show this message" << std::endl;
+}
+
+/**
+ * Main function:
+ * Parse the command line, then compare each kernel found in both reports.
+ * @returns 1 if a kernel regresses or is missing from the new report, 2 on an error or if no kernel was compared, 0 otherwise
+ */
+int main(int argc, char *argv[]) {
+  double threshold = 5, alpha = 0.01, floor = 0;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (arg.size() == 2 && arg[0] == '-') {
+      if (std::string("taf").find(arg[1]) == std::string::npos || i + 1 >= argc) {
+        std::cout << "ERROR: Invalid option " << arg << "." << std::endl;
+        printUsage(argv[0]);
+        return 2;
+      }
+      double value = atof(argv[++i]);
+      if (arg[1] == 't') threshold = value;
+      else if (arg[1] == 'a') alpha = value;
+      else floor = value * 1e-6;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.size() != 2) {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  SAMPLEMAP base = readReport(files[0]), curr = readReport(files[1]);
+  int regressions = 0, improvements = 0, compared = 0, missing = 0;
+  std::cout << std::left << std::setw(48) << "kernel" << std::right << std::setw(14) << "base us" << std::setw(14)
+            << "new us" << std::setw(10) << "change" << std::setw(10) << "p" << "  verdict" << std::endl;
+  for (SAMPLEMAP::iterator it = base.begin(); it != base.end(); ++it) {
+    SAMPLEMAP::iterator other = curr.find(it->first);
+    if (other == curr.end() || it->second.empty() || other->second.empty()) continue;
+    compared++;
+    double before = median(it->second), after = median(other->second);
+    double change = before > 0 ? 100 * (after - before) / before : 0;
+    double p = welchTest(it->second, other->second);
+    bool significant = p < 0 || p < alpha; // without a test, the threshold alone decides
+    std::string verdict = "";
+    if (fabs(after - before) >= floor && fabs(change) > threshold && significant) {
+      if (change > 0) {
+        verdict = "REGRESSION";
+        regressions++;
+      } else {
+        verdict = "improvement";
+        improvements++;
+      }
+    }
+    std::cout << std::left << std::setw(48) << it->first << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << before * 1e6 << std::setw(14) << after * 1e6 << std::showpos << std::setw(9)
+              << change << "%" << std::noshowpos << std::setprecision(4) << std::setw(10);
+    if (p < 0) std::cout << "-";
+    else std::cout << p;
+    std::cout << "  " << verdict << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+  }
+  for (SAMPLEMAP::iterator it = base.begin(); it != base.end(); ++it) {
+    SAMPLEMAP::iterator other = curr.find(it->first);
+    if (it->second.empty() || (other != curr.end() && !other->second.empty())) continue;
+    std::cout << "Missing: " << it->first << std::endl;
+    missing++;
+  }
+  for (SAMPLEMAP::iterator it = curr.begin(); it != curr.end(); ++it) {
+    if (!base.count(it->first)) std::cout << "New: " << it->first << std::endl;
+  }
+  std::cout << "\n" << compared << " compared, " << regressions << " regressions, " << improvements << " improvements, "
+            << missing << " missing" << std::endl;
+  if (compared == 0) {
+    std::cout << "ERROR: No kernel is found in both reports." << std::endl;
+    return 2;
+  }
+  return regressions > 0 || missing > 0 ? 1 : 0;
+}
@@ -15,22 +15,26 @@ public:
     return m_data[index];
   }
   std::size_t size() const {
-    return m_data.size();
+    return m_size;
   }
+  // split the next line at tabs into the strings of the previous rows, reusing their capacity
   void readNextRow(std::istream& str) {
-    std::string         line;
-    std::getline(str, line);
+    std::getline(str, m_line);
 
-    std::stringstream   lineStream(line);
-    std::string         cell;
-
-    m_data.clear();
-    while (std::getline(lineStream, cell, '\t')) {
-      m_data.push_back(cell);
+    std::size_t start = 0;
+    m_size = 0;
+    while (start < m_line.size()) {
+      std::size_t tab = m_line.find('\t', start);
+      if (tab == std::string::npos) tab = m_line.size();
+      if (m_size == m_data.size()) m_data.push_back(std::string());
+      m_data[m_size++].assign(m_line, start, tab - start);
+      start = tab + 1;
     }
   }
 private:
+  std::string                 m_line;
   std::vector<std::string>    m_data;
+  std::size_t                 m_size = 0;
 };
 
 std::istream& operator>>(std::istream& str, CSVRow& data) {
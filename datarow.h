@@ -8,51 +8,77 @@
 #include "nlohmann/json.hpp"    // used for construct geojson
 
 using json = nlohmann::json;
+// json allocating its nodes from the current arena
+typedef nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t, std::uint64_t, double, OutputAllocator> ArenaJson;
 
 class DataRow {
 private:
   tm datetime_;
   double lon_;
   double lat_;
-  std::string tag_;
+  ArenaString tag_;
   int areaId_;
+  int cellId_; // index of the cell of the tag in its User, -1 if the row is in no User
 
 public:
-  DataRow(tm datetime, double lon, double lat, std::string tag) {
+  DataRow(tm datetime, double lon, double lat, const std::string &tag) : tag_(tag.data(), tag.size()) {
     datetime_ = datetime;
     lon_ = lon;
     lat_ = lat;
-    tag_ = tag;
     areaId_ = 0;
+    cellId_ = -1;
   }
   double getLon() { return lon_; }
   double getLat() { return lat_; }
   tm getDateTime() { return datetime_; }
-  std::string getTag() { return tag_; }
+  const ArenaString& getTag() { return tag_; }
   void setAreaID(int id) { areaId_ = id; }
   int getAreaID() { return areaId_; }
+  void setCellID(int id) { cellId_ = id; }
+  int getCellID() { return cellId_; }
 };
 
+typedef std::vector<DataRow, RowAllocator<DataRow> > ROWLIST;
+
 struct compareByTime {
   bool operator()(DataRow & a, DataRow & b) {
     return difftime(getTimeValue(a.getDateTime()), getTimeValue(b.getDateTime())) < 0;
   }
 };
 
-void createJsonFile(std::string filename, std::vector<DataRow>& list, int low, int high) {
+void createJsonFile(std::string filename, ROWLIST& list, int low, int high) {
+  PROFILE_STAGE("createJsonFile");
+  PROFILE_ROWS(high - low);
   std::ofstream ofsMap(filename);
-  json map;
+  ArenaJson map;
   map["type"] = "MultiPoint";
   map["coordinates"] = {};
   for (int i = low; i < high; i++) {
     map["coordinates"] += {list[i].getLon(), list[i].getLat()};
   }
   ofsMap << map.dump(4);  // format(4) is easy to read
+  countBytesWritten(ofsMap.tellp());
+  ofsMap.close();
+}
+
+// Same as createJsonFile(filename, list, low, high), where coords holds the lon, lat of each row in turn.
+void createJsonFile(std::string filename, const std::vector<double>& coords) {
+  PROFILE_STAGE("createJsonFile");
+  PROFILE_ROWS(coords.size() / 2);
+  std::ofstream ofsMap(filename);
+  ArenaJson map;
+  map["type"] = "MultiPoint";
+  map["coordinates"] = {};
+  for (int i = 0; i + 1 < coords.size(); i += 2) {
+    map["coordinates"] += {coords[i], coords[i + 1]};
+  }
+  ofsMap << map.dump(4);  // format(4) is easy to read
+  countBytesWritten(ofsMap.tellp());
   ofsMap.close();
 }
 
 // reference: https://stackoverflow.com/questions/6671183/calculate-the-center-point-of-multiple-latitude-longitude-coordinate-pairs
-std::vector<double> centerOfGravity (std::vector<DataRow> &list, int areaID) {
+std::vector<double> centerOfGravity (ROWLIST &list, int areaID) {
   std::vector<double> midpoints(2); //Lat, Lon
   std::cout << "\nMethod: Center of gravity" << std::endl;
   std::cout << "Area " << std::to_string(areaID) << std::endl;
@@ -77,7 +103,7 @@ std::vector<double> centerOfGravity (std::vector<DataRow> &list, int areaID) {
   return midpoints;
 }
 
-std::vector<double> averageLatLon (std::vector<DataRow> &list, int areaID) {
+std::vector<double> averageLatLon (ROWLIST &list, int areaID) {
   std::vector<double> midpoints(2); //Lat, Lon
   std::cout << "\nMethod: Average latitude/longitude" << std::endl;
   std::cout << "Area " << std::to_string(areaID) << std::endl;
@@ -98,7 +124,7 @@ std::vector<double> averageLatLon (std::vector<DataRow> &list, int areaID) {
   return midpoints;
 }
 
-void midpointAnalysis(std::vector<DataRow> &list, int areaCount, bool useAverage) {
+void midpointAnalysis(ROWLIST &list, int areaCount, bool useAverage) {
   std::string method = "gravity";
   if (useAverage) method = "average";
   for (int i = 1; i <= areaCount; i++) {
@@ -155,7 +181,7 @@ void midpointAnalysis(std::vector<DataRow> &list, int areaCount, bool useAverage
 }
 
 // generate inputs of a web calculator http://www.geomidpoint.com/
-void generateGeoFiles(std::vector<DataRow> &list, int areaCount) {
+void generateGeoFiles(ROWLIST &list, int areaCount) {
   for (int i = 1; i <= areaCount; i++) {
     std::ofstream ofsLon("area-" + std::to_string(i) + "-lon.txt");
     std::ofstream ofsLat("area-" + std::to_string(i) + "-lat.txt");
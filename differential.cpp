@@ -0,0 +1,308 @@
+#include "csv_parser.h"         // used for csv parsing
+#include "haversine_formula.h"  // used for calculating the great-circle distance
+#include "user.h"
+#include "trace_generator.h"    // used for generating the cases
+#include "differential.h"       // used for checking the variants against the references
+#include <unistd.h>
+#include <sys/stat.h>
+
+// sort the rows of c, then fill its cells; with labelTopCells, label the rows of the 3 largest cells as areas 1 to 3
+void finishCase(DiffCase &c, bool labelTopCells) {
+  sort(c.rows.begin(), c.rows.end(), compareByTime());
+  TAGMAP cellMap;
+  for (DataRow &d : c.rows) {
+    int &idx = cellMap[d.getTag()];
+    if (c.cells.size() < cellMap.size()) {
+      idx = c.cells.size();
+      c.cells.push_back(Cell(d.getTag()));
+    }
+    c.cells[idx].addDataRow(d);
+  }
+  if (!labelTopCells) return;
+  std::vector<int> order(c.cells.size());
+  for (int i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return c.cells[a].numConnections() > c.cells[b].numConnections(); });
+  c.areaCount = std::min(3, (int)order.size());
+  for (int a = 0; a < c.areaCount; a++) {
+    const ArenaString &tag = c.cells[order[a]].getName();
+    for (DataRow &d : c.rows) {
+      if (d.getTag() == tag) d.setAreaID(a + 1);
+    }
+  }
+}
+
+// a case read from a file written by the trace generator
+void generatedCase(DiffCase &c, TraceConfig config, const std::string &filename) {
+  TraceGenerator(config).writeUser(0, filename);
+  std::ifstream dataSource(filename);
+  CSVRow row;
+  dataSource >> row; // skip the first line
+  while (dataSource >> row) {
+    tm tm = {};
+    parseDateTime(row[0], tm);
+    c.rows.push_back(DataRow(tm, stod(row[1]), stod(row[2]), row[3]));
+  }
+  c.interval = 180;
+  finishCase(c, true);
+}
+
+/**
+ * A case of random rows: few or many rows and cells, timestamps with duplicates and gaps close to the interval,
+ * coordinates anywhere on the Earth (poles and antimeridian included) or within a few meters, and random areas,
+ * some of which may have no rows.
+ */
+void fuzzedCase(DiffCase &c, TraceRandom &random) {
+  int numRows = 1 + random.next() % (random.uniform() < 0.2 ? 8 : 2000);
+  int numCells = 1 + random.next() % 20;
+  bool local = random.uniform() < 0.5;
+  c.interval = 1 + random.next() % 600;
+  time_t t = 1511395200 + random.next() % 86400; // 2017-11-23
+  for (int i = 0; i < numRows; i++) {
+    double u = random.uniform();
+    if (u < 0.2) t += 0;                                           // same second as the previous row
+    else if (u < 0.4) t += c.interval - 1 + random.next() % 3;     // around the interval
+    else t += random.next() % (3 * c.interval);
+    tm datetime = {};
+    gmtime_r(&t, &datetime);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &datetime);
+    tm parsed = {};
+    parseDateTime(buffer, parsed); // as read from a data file
+    double lat = local ? 25.04 + 1e-4 * random.uniform() : 180 * random.uniform() - 90;
+    double lon = local ? 121.51 + 1e-4 * random.uniform() : 360 * random.uniform() - 180;
+    if (random.uniform() < 0.02) lat = random.uniform() < 0.5 ? 90 : -90;
+    if (random.uniform() < 0.02) lon = random.uniform() < 0.5 ? 180 : -180;
+    c.rows.push_back(DataRow(parsed, lon, lat, "CELL_" + std::to_string(random.next() % numCells)));
+  }
+  for (int i = numRows - 1; i > 0; i--) std::swap(c.rows[i], c.rows[random.next() % (i + 1)]); // unsorted, as in a file
+  finishCase(c, false);
+  c.areaCount = random.next() % 4;
+  for (DataRow &d : c.rows) d.setAreaID(random.next() % (c.areaCount + 2)); // areaCount + 1 is not analysed
+}
+
+// collects the pair distances of a scan
+class PairDistanceKernel : public ScanKernel {
+public:
+  std::vector<double> distances;
+  int needs() { return SCAN_PAIR; };
+  void visit(const ScanRow &r) { distances.push_back(r.pairDistance); };
+};
+
+// @returns the lines of text
+std::vector<std::string> linesOf(const std::string &text) {
+  std::vector<std::string> lines;
+  std::stringstream ss(text);
+  std::string line;
+  while (std::getline(ss, line)) lines.push_back(line);
+  return lines;
+}
+
+// @returns the time segments of the reference, as printed by the CellSegmentKernel
+std::vector<std::string> segmentLines(SEGMENTLIST segments) {
+  std::vector<std::string> lines;
+  for (TIMEPAIR tp : segments) lines.push_back(getTimeString(tp.first, 0) + "-to-" + getTimeString(tp.second, 0));
+  return lines;
+}
+
+// @returns the number of lines that differ
+double lineDifference(const std::vector<std::string> &a, const std::vector<std::string> &b) {
+  double diff = fabs((double)a.size() - (double)b.size());
+  for (int i = 0; i < a.size() && i < b.size(); i++) diff += a[i] != b[i];
+  return diff;
+}
+
+std::string readText(const std::string &filename) {
+  std::ifstream ifs(filename);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+// the reference functions print to std::cout; captures what they print
+class CoutCapture {
+private:
+  std::stringstream ss_;
+  std::streambuf *buf_;
+
+public:
+  CoutCapture() : buf_(std::cout.rdbuf(ss_.rdbuf())) {};
+  ~CoutCapture() { std::cout.rdbuf(buf_); };
+  std::string text() { return ss_.str(); };
+};
+
+// every variant of the tree, each checked against its reference
+void addChecks(DifferentialSuite &suite) {
+  suite.add("distanceEarth", "AnalysisGraph::pairDistance", 1e-12, [](DiffCase &c) {
+    AnalysisGraph graph(c.rows);
+    const COLUMN<double> &d = graph.pairDistance();
+    double diff = 0;
+    for (int i = 1; i < c.rows.size(); i++)
+      diff = fmax(diff, fabs(d[i] - distanceEarth(c.rows[i - 1].getLat(), c.rows[i - 1].getLon(), c.rows[i].getLat(), c.rows[i].getLon())));
+    return diff;
+  });
+  suite.add("distanceEarth", "ScanEngine pairDistance", 1e-12, [](DiffCase &c) {
+    ScanEngine engine;
+    PairDistanceKernel kernel;
+    engine.add(&kernel);
+    engine.begin(); // pushed row by row, as from an ExternalSorter
+    for (DataRow &d : c.rows) engine.push(d);
+    engine.end();
+    double diff = 0;
+    for (int i = 1; i < c.rows.size(); i++)
+      diff = fmax(diff, fabs(kernel.distances[i] - distanceEarth(c.rows[i - 1].getLat(), c.rows[i - 1].getLon(), c.rows[i].getLat(), c.rows[i].getLon())));
+    return diff;
+  });
+
+  // no other implementation of merge yet: its result must not depend on the order of its arguments
+  suite.add("merge", "arguments swapped", 0, [](DiffCase &c) {
+    double diff = 0;
+    for (int i = 0; i + 1 < c.cells.size() && i < 8; i++) {
+      SEGMENTLIST a = c.cells[i].getTimeSegments(c.interval), b = c.cells[i + 1].getTimeSegments(c.interval);
+      diff += lineDifference(segmentLines(merge(a, b)), segmentLines(merge(b, a)));
+    }
+    return diff;
+  });
+
+  suite.add("getTimeSegments", "CellSegmentKernel", 0, [](DiffCase &c) {
+    double diff = 0;
+    for (int i = 0; i < c.cells.size() && i < 8; i++) {
+      std::stringstream log;
+      ScanEngine engine;
+      CellSegmentKernel kernel(std::string(c.cells[i].getName().c_str()), c.interval, false, true, log);
+      engine.add(&kernel);
+      AnalysisGraph graph(c.rows);
+      engine.run(graph);
+      diff += lineDifference(segmentLines(c.cells[i].getTimeSegments(c.interval)), linesOf(log.str()));
+    }
+    return diff;
+  });
+  suite.add("getTimeSegments", "ExternalSorter (out of core)", 0, [](DiffCase &c) {
+    double diff = 0;
+    for (int i = 0; i < c.cells.size() && i < 4; i++) {
+      std::stringstream log;
+      ScanEngine engine;
+      CellSegmentKernel kernel(std::string(c.cells[i].getName().c_str()), c.interval, false, true, log);
+      engine.add(&kernel);
+      ExternalSorter sorter(4096, "diff-spill-"); // a few rows per run, to go through the merge passes
+      for (DataRow &d : c.rows) sorter.add(d.getDateTime(), d.getLon(), d.getLat(), std::string(d.getTag().c_str()));
+      sorter.merge(engine);
+      diff += lineDifference(segmentLines(c.cells[i].getTimeSegments(c.interval)), linesOf(log.str()));
+    }
+    return diff;
+  });
+
+  suite.add("centerOfGravity", "AnalysisGraph", 1e-9, [](DiffCase &c) {
+    AnalysisGraph graph(c.rows);
+    graph.setAreaLabeler([](DataRow &r) { return r.getAreaID(); });
+    double diff = 0;
+    for (int a = 1; a <= c.areaCount; a++) {
+      std::vector<double> variant = centerOfGravity(graph, a, nullptr), reference;
+      {
+        CoutCapture capture;
+        reference = centerOfGravity(c.rows, a);
+      }
+      for (int k = 0; k < 2; k++) {
+        if (std::isnan(variant[k]) && std::isnan(reference[k])) continue;
+        diff = fmax(diff, fabs(variant[k] - reference[k]));
+      }
+    }
+    return diff;
+  });
+
+  // compares the log and the CDF files of both methods
+  suite.add("midpointAnalysis", "AnalysisGraph", 1e-9, [](DiffCase &c) {
+    AnalysisGraph graph(c.rows);
+    graph.setAreaLabeler([](DataRow &r) { return r.getAreaID(); });
+    double diff = 0;
+    for (int useAverage = 0; useAverage < 2; useAverage++) {
+      std::stringstream log;
+      midpointAnalysis(graph, c.areaCount, useAverage, &log, "graph-", true);
+      std::string reference;
+      {
+        CoutCapture capture;
+        midpointAnalysis(c.rows, c.areaCount, useAverage);
+        reference = capture.text();
+      }
+      diff = fmax(diff, textDifference(reference, log.str()));
+      std::string method = useAverage ? "average" : "gravity";
+      for (int a = 1; a <= c.areaCount; a++) {
+        std::string file = method + "-area-" + std::to_string(a) + ".csv";
+        diff = fmax(diff, textDifference(readText(file), readText("graph-" + file)));
+      }
+    }
+    return diff;
+  });
+}
+
+void printUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options]" << std::endl;
+  std::cout << "Check the variants of the kernels against their reference implementations, on generated and fuzzed cases." << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  -n <cases>     number of fuzzed cases (default: 200)" << std::endl;
+  std::cout << "  -g <seeds>     number of seeds of the generated cases, each with every tower layout (default: 3)" << std::endl;
+  std::cout << "  -r <seed>      seed of the cases (default: 1)" << std::endl;
+  std::cout << "  -k <kernel>    only check the kernels whose name contains <kernel>" << std::endl;
+  std::cout << "  -d <dir>       directory of the files written by the kernels (default: diff-scratch)" << std::endl;
+  std::cout << "  -h             show this message" << std::endl;
+}
+
+/**
+ * Main function:
+ * Parse the command line, then run every check on the generated and fuzzed cases.
+ * @returns 1 if a variant differs from its reference by more than its tolerance, 0 otherwise
+ */
+int main(int argc, char *argv[]) {
+  int fuzzCases = 200, seeds = 3;
+  unsigned long long seed = 1;
+  std::string filter, dir = "diff-scratch";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (arg.size() != 2 || arg[0] != '-' || std::string("ngrkd").find(arg[1]) == std::string::npos || i + 1 >= argc) {
+      std::cout << "ERROR: Invalid option " << arg << "." << std::endl;
+      printUsage(argv[0]);
+      return 2;
+    }
+    std::string value = argv[++i];
+    switch (arg[1]) {
+      case 'n': fuzzCases = std::max(0, atoi(value.c_str())); break;
+      case 'g': seeds = std::max(0, atoi(value.c_str())); break;
+      case 'r': seed = strtoull(value.c_str(), nullptr, 10); break;
+      case 'k': filter = value; break;
+      case 'd': dir = value; break;
+    }
+  }
+  mkdir(dir.c_str(), 0755);
+  if (chdir(dir.c_str()) != 0) {
+    std::cout << "ERROR: The directory " << dir << " cannot be used." << std::endl;
+    return 2;
+  }
+
+  DifferentialSuite suite(filter);
+  addChecks(suite);
+  const char *layouts[] = {"grid", "random", "clustered"};
+  for (int s = 0; s < seeds; s++) {
+    for (int l = 0; l < 3; l++) {
+      TraceConfig config = TraceConfig::defaults();
+      config.towers = 100 + 150 * l;
+      config.layout = (TowerLayout)l;
+      config.cityKm = 10 + 5.0 * s;
+      config.seed = seed + s;
+      DiffCase c;
+      c.name = std::string(layouts[l]) + " seed " + std::to_string(seed + s);
+      generatedCase(c, config, "diff-trace.csv");
+      suite.run(c);
+    }
+  }
+  TraceRandom random(seed, 0);
+  for (int i = 0; i < fuzzCases; i++) {
+    DiffCase c;
+    c.name = "fuzz " + std::to_string(i);
+    fuzzedCase(c, random);
+    suite.run(c);
+  }
+  return suite.report(std::cout) ? 0 : 1;
+}
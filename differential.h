@@ -0,0 +1,98 @@
+/**
+ * @file
+ * @brief Harness of the differential tests.
+ * @details
+ * The current implementations of the kernels are the reference oracles. A DiffCheck runs a variant of a kernel
+ * (e.g. a column of the AnalysisGraph, a scan kernel, or a future fast path) and its reference on the same case,
+ * and measures the largest difference of their results; the variant passes if, over every case, that difference
+ * stays within the tolerance of the check. A DifferentialSuite runs its checks on generated and fuzzed cases,
+ * keeps the worst case of each check, and reports which variants can be switched on.
+ */
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <limits>
+
+// rows of a user, sorted by time and labelled with areas 1 to areaCount, and their cells
+struct DiffCase {
+  std::string name;
+  ROWLIST rows;
+  std::vector<Cell> cells;
+  int areaCount;
+  int interval;
+};
+
+struct DiffCheck {
+  std::string kernel;                       // name of the reference
+  std::string variant;                      // name of the variant
+  double tolerance;                         // largest difference allowed
+  std::function<double(DiffCase &)> error;  // largest difference between the variant and the reference on a case
+  int cases;
+  double maxError;
+  std::string worstCase;
+};
+
+class DifferentialSuite {
+private:
+  std::vector<DiffCheck> checks_;
+  std::string filter_; // only checks whose kernel contains filter_ are run
+
+public:
+  DifferentialSuite(std::string filter) : filter_(filter) {};
+  void add(std::string kernel, std::string variant, double tolerance, std::function<double(DiffCase &)> error) {
+    if (kernel.find(filter_) == std::string::npos) return;
+    checks_.push_back({kernel, variant, tolerance, error, 0, 0, ""});
+  };
+  void run(DiffCase &c);
+  bool report(std::ostream &out);
+};
+
+void DifferentialSuite::run(DiffCase &c) {
+  for (DiffCheck &check : checks_) {
+    double e = check.error(c);
+    if (std::isnan(e)) e = std::numeric_limits<double>::infinity();
+    check.cases++;
+    if (e > check.maxError || check.worstCase.empty()) {
+      check.maxError = std::max(check.maxError, e);
+      check.worstCase = c.name;
+    }
+  }
+}
+
+// print the largest difference of each check, and @returns whether every check is within its tolerance
+bool DifferentialSuite::report(std::ostream &out) {
+  bool passed = true;
+  out << std::left << std::setw(20) << "kernel" << std::setw(34) << "variant" << std::right << std::setw(8) << "cases"
+      << std::setw(14) << "max error" << std::setw(12) << "tolerance" << "  result (worst case)" << std::endl;
+  for (DiffCheck &check : checks_) {
+    bool ok = check.maxError <= check.tolerance;
+    passed = passed && ok;
+    out << std::left << std::setw(20) << check.kernel << std::setw(34) << check.variant << std::right << std::setw(8)
+        << check.cases << std::setw(14) << std::setprecision(4) << check.maxError << std::setw(12) << check.tolerance
+        << "  " << (ok ? "PASS" : "FAIL") << " (" << check.worstCase << ")" << std::endl;
+  }
+  return passed;
+}
+
+/**
+ * Compare two texts (e.g. output files or logs) whose numbers may differ by rounding.
+ * @returns the largest difference between their numbers, or infinity if the rest of the texts differ
+ */
+double textDifference(const std::string &a, const std::string &b) {
+  const char *p = a.c_str(), *q = b.c_str();
+  double diff = 0;
+  while (*p && *q) {
+    bool numP = isdigit(*p) || ((*p == '-' || *p == '.') && isdigit(p[1]));
+    bool numQ = isdigit(*q) || ((*q == '-' || *q == '.') && isdigit(q[1]));
+    if (numP && numQ) {
+      char *endP, *endQ;
+      double x = strtod(p, &endP), y = strtod(q, &endQ);
+      diff = std::max(diff, fabs(x - y));
+      p = endP;
+      q = endQ;
+    } else if (*p++ != *q++) {
+      return std::numeric_limits<double>::infinity();
+    }
+  }
+  return *p || *q ? std::numeric_limits<double>::infinity() : diff;
+}
@@ -0,0 +1,250 @@
+/**
+ * @file
+ * @brief Out-of-core sorting of data logs larger than the memory.
+ * @details
+ * The ExternalSorter sorts the rows of a data file by time within a memory budget:
+ * 1. Rows are parsed into a buffer, reserved once to the budget; when its records and their tags reach the budget,
+ *    it is sorted in place and spilled to a run file.
+ * 2. Runs are merged k at a time, with k such that the read buffers of the runs fit in the budget, and bounded
+ *    by the limit of open files, until at most k runs are left.
+ * 3. The last runs are merged on the fly, and each row is pushed into a ScanEngine in the order of time.
+ *    If every row fits in the budget, the buffer is sorted and pushed without any run file.
+ * Only the analyses working in one streaming pass (the scan kernels) can run out of core.
+ * Rows with the same time keep the order of the file, whereas the in-memory sort of User leaves them in any order.
+ */
+#include <cstdio>
+#include <queue>
+#include <sys/resource.h>
+
+class ExternalSorter {
+private:
+  struct SortRecord {
+    long long key;      // seconds of the datetime taken as UTC, in the same order as getTimeValue
+    long seq;           // of the row in the file, to keep rows with the same key in the order of the file
+    double lon;
+    double lat;
+    std::string tag;
+  };
+
+  // sequential reader of a run file
+  class RunReader {
+  private:
+    FILE *file_;
+    std::vector<char> buffer_;
+
+  public:
+    SortRecord record;
+    RunReader(std::string filename, size_t bufferSize) : buffer_(bufferSize) {
+      file_ = fopen(filename.c_str(), "rb");
+      if (!file_) {
+        std::cout << "ERROR: The run file " << filename << " cannot be opened." << std::endl;
+        exit(0);
+      }
+      setvbuf(file_, buffer_.data(), _IOFBF, buffer_.size());
+    };
+    ~RunReader() { fclose(file_); };
+    bool next() {
+      unsigned short len;
+      if (fread(&record.key, sizeof(record.key), 1, file_) != 1) return false;
+      if (fread(&record.lon, sizeof(record.lon), 1, file_) != 1 ||
+          fread(&record.lat, sizeof(record.lat), 1, file_) != 1 ||
+          fread(&len, sizeof(len), 1, file_) != 1) return false;
+      record.tag.resize(len);
+      return len == 0 || fread(&record.tag[0], 1, len, file_) == len;
+    };
+  };
+
+  size_t memoryBudget_;
+  std::string spillPrefix_;
+  std::vector<SortRecord, IngestAllocator<SortRecord> > buffer_;
+  size_t bufferBytes_;
+  std::vector<std::string> runs_;
+  int runID_;
+  long rows_;
+
+  static long long keyOf(const tm &t);
+  static size_t bytesOf(const SortRecord &r) {
+    return sizeof(SortRecord) + (r.tag.size() > 15 ? r.tag.capacity() : 0);
+  };
+  static void writeRecord(FILE *file, const SortRecord &r);
+  static DataRow rowOf(const SortRecord &r);
+  int fanIn();
+  void sortBuffer();
+  void spill();
+  void mergeRuns(std::vector<std::string> runs, std::function<void(SortRecord &)> emit);
+
+public:
+  ExternalSorter(size_t memoryBudget, std::string spillPrefix) :
+    memoryBudget_(memoryBudget), spillPrefix_(spillPrefix), bufferBytes_(0), runID_(0), rows_(0) {};
+  ~ExternalSorter() {
+    for (std::string &run : runs_) remove(run.c_str());
+  };
+  void readFile(std::string filename);
+  void add(const tm &datetime, double lon, double lat, const std::string &tag);
+  void merge(ScanEngine &engine);
+  long rows() { return rows_; };
+  int numRuns() { return runID_; };
+};
+
+// @returns the seconds since the epoch of t taken as UTC, which sorts rows as getTimeValue does
+long long ExternalSorter::keyOf(const tm &t) {
+  tm copy = t;
+  return timegm(&copy);
+}
+
+void ExternalSorter::writeRecord(FILE *file, const SortRecord &r) {
+  unsigned short len = r.tag.size();
+  fwrite(&r.key, sizeof(r.key), 1, file);
+  fwrite(&r.lon, sizeof(r.lon), 1, file);
+  fwrite(&r.lat, sizeof(r.lat), 1, file);
+  fwrite(&len, sizeof(len), 1, file);
+  fwrite(r.tag.data(), 1, len, file);
+}
+
+/**
+ * @returns the number of runs merged at a time, each run with a read buffer of at least 64 KiB, and at most 64 runs
+ * or a sixteenth of the limit of open files, so that the workers of a batch merging at the same time stay below it
+ */
+int ExternalSorter::fanIn() {
+  size_t k = std::min(memoryBudget_ / (64 << 10), (size_t)64);
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) k = std::min(k, (size_t)limit.rlim_cur / 16);
+  return k < 2 ? 2 : (int)k;
+}
+
+void ExternalSorter::readFile(std::string filename) {
+  PROFILE_STAGE("ExternalSorter::readFile");
+  std::ifstream dataSource(filename);
+  if (!dataSource) {
+    std::cout << "ERROR: The file cannot be opened." << std::endl;
+    exit(0);
+  }
+
+  CSVRow row;
+  dataSource >> row; // skip the first line
+  while (dataSource >> row) {
+    tm tm = {};
+    parseDateTime(row[0], tm);
+    add(tm, stod(row[1]), stod(row[2]), row[3]);
+    PROFILE_ROWS(1);
+    if (rows_ % 4096 == 0) RunMetrics::global().add(RunMetrics::global().rowsParsed, 4096);
+  }
+  dataSource.close();
+  RunMetrics::global().add(RunMetrics::global().rowsParsed, rows_ % 4096);
+}
+
+/**
+ * Add a row to the buffer, reserved for a budget of records on the first row so that it never grows.
+ * The buffer is spilled once its records and the heap memory of their tags reach the budget.
+ */
+void ExternalSorter::add(const tm &datetime, double lon, double lat, const std::string &tag) {
+  if (buffer_.capacity() == 0) buffer_.reserve(std::max(memoryBudget_ / sizeof(SortRecord), (size_t)1));
+  SortRecord r = {keyOf(datetime), rows_, lon, lat, tag};
+  bufferBytes_ += bytesOf(r);
+  buffer_.push_back(r);
+  rows_++;
+  if (bufferBytes_ >= memoryBudget_ || buffer_.size() == buffer_.capacity()) spill();
+}
+
+// sort the buffer by time, in place, rows with the same time in the order of the file
+void ExternalSorter::sortBuffer() {
+  std::sort(buffer_.begin(), buffer_.end(), [](const SortRecord &a, const SortRecord &b) {
+    return a.key < b.key || (a.key == b.key && a.seq < b.seq);
+  });
+}
+
+// sort the buffer and write it to a new run file; the buffer keeps its memory for the next rows
+void ExternalSorter::spill() {
+  PROFILE_STAGE("spill");
+  PROFILE_ROWS(buffer_.size());
+  sortBuffer();
+  std::string run = spillPrefix_ + std::to_string(runID_++) + ".run";
+  FILE *file = fopen(run.c_str(), "wb");
+  if (!file) {
+    std::cout << "ERROR: The run file " << run << " cannot be created." << std::endl;
+    exit(0);
+  }
+  for (SortRecord &r : buffer_) writeRecord(file, r);
+  PROFILE_BYTES(ftell(file));
+  fclose(file);
+  runs_.push_back(run);
+  buffer_.clear();
+  bufferBytes_ = 0;
+}
+
+// @returns the row of a record, with the datetime of its key
+DataRow ExternalSorter::rowOf(const SortRecord &r) {
+  time_t t = r.key;
+  tm datetime = {};
+  gmtime_r(&t, &datetime);
+  return DataRow(datetime, r.lon, r.lat, r.tag);
+}
+
+/**
+ * k-way merge of sorted runs, emitting each record in the order of time.
+ * Records with the same time are emitted in the order of their runs, so the merge is stable.
+ */
+void ExternalSorter::mergeRuns(std::vector<std::string> runs, std::function<void(SortRecord &)> emit) {
+  size_t bufferSize = std::min(memoryBudget_ / (runs.size() + 1), (size_t)1 << 20); // larger buffers gain little
+  std::vector<std::unique_ptr<RunReader> > readers;
+  typedef std::pair<long long, int> HEAD; // key of the next record, index of its reader
+  std::priority_queue<HEAD, std::vector<HEAD>, std::greater<HEAD> > heads;
+  for (int i = 0; i < runs.size(); i++) {
+    readers.push_back(std::unique_ptr<RunReader>(new RunReader(runs[i], bufferSize)));
+    if (readers[i]->next()) heads.push(HEAD(readers[i]->record.key, i));
+  }
+  while (!heads.empty()) {
+    int i = heads.top().second;
+    heads.pop();
+    emit(readers[i]->record);
+    if (readers[i]->next()) heads.push(HEAD(readers[i]->record.key, i));
+  }
+}
+
+/**
+ * Merge the sorted rows and push them into engine in the order of time.
+ * Intermediate merge passes reduce the number of runs until they can be merged in one pass within the budget.
+ */
+void ExternalSorter::merge(ScanEngine &engine) {
+  PROFILE_STAGE("ExternalSorter::merge");
+  PROFILE_ROWS(rows_);
+  if (runs_.empty()) { // every row fits in the budget
+    sortBuffer();
+    engine.begin();
+    for (SortRecord &r : buffer_) {
+      DataRow d = rowOf(r);
+      engine.push(d);
+    }
+    engine.end();
+    std::vector<SortRecord, IngestAllocator<SortRecord> >().swap(buffer_);
+    return;
+  }
+  if (!buffer_.empty()) spill();
+  std::vector<SortRecord, IngestAllocator<SortRecord> >().swap(buffer_); // release the memory of the buffer
+  int k = fanIn();
+  while (runs_.size() > k) {
+    std::vector<std::string> merged;
+    for (int i = 0; i < runs_.size(); i += k) {
+      std::vector<std::string> group(runs_.begin() + i, runs_.begin() + std::min(i + k, (int)runs_.size()));
+      std::string run = spillPrefix_ + std::to_string(runID_++) + ".run";
+      FILE *file = fopen(run.c_str(), "wb");
+      if (!file) {
+        std::cout << "ERROR: The run file " << run << " cannot be created." << std::endl;
+        exit(0);
+      }
+      mergeRuns(group, [file](SortRecord &r) { writeRecord(file, r); });
+      PROFILE_BYTES(ftell(file));
+      fclose(file);
+      for (std::string &g : group) remove(g.c_str());
+      merged.push_back(run);
+    }
+    runs_ = merged;
+  }
+
+  engine.begin();
+  mergeRuns(runs_, [&engine](SortRecord &r) {
+    DataRow d = rowOf(r);
+    engine.push(d);
+  });
+  engine.end();
+}
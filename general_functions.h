@@ -1,8 +1,14 @@
 #include <ctime>
 #include <string>
 #include <iostream>
+#include "arena.h"
+#include "tag_map.h"
+#include "perf_counters.h"
+#include "stage_profile.h"
+#include "run_metrics.h"
 
 typedef std::pair<tm, tm> TIMEPAIR;
+typedef std::vector<TIMEPAIR, SegmentAllocator<TIMEPAIR> > SEGMENTLIST;
 
 std::string getTimeString(tm datetime, bool useColon) {
   char buffer[50];
@@ -11,6 +17,11 @@ std::string getTimeString(tm datetime, bool useColon) {
   return buffer;
 }
 
+// parse a datetime of the data logs, as std::get_time with the same format but without a stream per row
+void parseDateTime(const std::string &s, tm &datetime) {
+  strptime(s.c_str(), "%Y-%m-%d %H:%M:%S", &datetime);
+}
+
 time_t getTimeValue(tm datetime) {
   time_t t = mktime(&datetime); 
   if (t == -1) {
@@ -20,9 +31,12 @@ time_t getTimeValue(tm datetime) {
   return t;
 };
 
-std::vector<TIMEPAIR> merge(std::vector<TIMEPAIR> v1, std::vector<TIMEPAIR> v2) {
-  std::vector<TIMEPAIR> merged;
-  std::vector<TIMEPAIR> *target = &v1;
+// SegList is a vector of TIMEPAIR, e.g. SEGMENTLIST
+template <class SegList>
+SegList merge(const SegList &v1, const SegList &v2) {
+  SegList merged;
+  merged.reserve(v1.size() + v2.size()); // at most, so merging allocates once
+  const SegList *target = &v1;
   int idx1 = 0, idx2 = 0, idxTarget = 0;
   while (idx1 <= v1.size() && idx2 <= v2.size()) {
     if (idx1 < v1.size() && idx2 < v2.size()) {
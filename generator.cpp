@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <sys/stat.h>
+#include "nlohmann/json.hpp"    // used for the ground truth
+#include "trace_generator.h"
+
+using json = nlohmann::json;
+
+void printUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options]" << std::endl;
+  std::cout << "Write synthetic data files in the format of data.csv, and their ground truth to <name>-truth.json." << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  -u <users>     number of users, each written to its own file (default: 1)" << std::endl;
+  std::cout << "  -n <days>      number of days of each user (default: 1)" << std::endl;
+  std::cout << "  -D <date>      first day, YYYY-MM-DD (default: 2017-11-23)" << std::endl;
+  std::cout << "  -t <towers>    number of towers (default: 400)" << std::endl;
+  std::cout << "  -l <layout>    tower layout: grid, random or clustered (default: grid)" << std::endl;
+  std::cout << "  -w <km>        width of the city (default: 20)" << std::endl;
+  std::cout << "  -i <seconds>   mean interval between rows (default: 30)" << std::endl;
+  std::cout << "  -v <km/h>      trip speed (default: 30)" << std::endl;
+  std::cout << "  -p <prob>      probability of a ping-pong handover near a cell edge (default: 0.2)" << std::endl;
+  std::cout << "  -e <meters>    standard deviation of the position noise (default: 50)" << std::endl;
+  std::cout << "  -r <seed>      seed of the random numbers (default: 1)" << std::endl;
+  std::cout << "  -d <dir>       directory of the files (default: .)" << std::endl;
+  std::cout << "  -o <name>      name of the files: <name>.csv for one user, <name>-<i>.csv for several (default: trace)" << std::endl;
+  std::cout << "  -j <threads>   number of files written in parallel (default: 1)" << std::endl;
+  std::cout << "  -h             show this message" << std::endl;
+}
+
+double parseNumber(std::string value, std::string name, double min) {
+  char *end;
+  double x = strtod(value.c_str(), &end);
+  if (*end != '\0' || !(x >= min)) {
+    std::cout << "ERROR: Invalid " << name << " " << value << "." << std::endl;
+    exit(0);
+  }
+  return x;
+}
+
+/**
+ * Main function:
+ * Parse the command line, then write the file of each user and the ground truth of all users.
+ * @returns 0 on exit
+ */
+int main(int argc, char *argv[]) {
+  TraceConfig config = TraceConfig::defaults();
+  std::string dir = ".", name = "trace";
+  int threads = 1;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (arg.size() != 2 || arg[0] != '-' || std::string("unDtlwivperdoj").find(arg[1]) == std::string::npos) {
+      std::cout << "ERROR: Unknown option " << arg << "." << std::endl;
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      std::cout << "ERROR: Missing value of " << arg << "." << std::endl;
+      return 0;
+    }
+    std::string value = argv[++i];
+    switch (arg[1]) {
+      case 'u': config.users = (int)parseNumber(value, "number of users", 1); break;
+      case 'n': config.days = (int)parseNumber(value, "number of days", 1); break;
+      case 'D': config.startDate = value; break;
+      case 't': config.towers = (int)parseNumber(value, "number of towers", 2); break;
+      case 'l':
+        if (value == "grid") config.layout = LAYOUT_GRID;
+        else if (value == "random") config.layout = LAYOUT_RANDOM;
+        else if (value == "clustered") config.layout = LAYOUT_CLUSTERED;
+        else {
+          std::cout << "ERROR: Unknown layout " << value << "." << std::endl;
+          return 0;
+        }
+        break;
+      case 'w': config.cityKm = parseNumber(value, "city width", 0.1); break;
+      case 'i': config.pingInterval = parseNumber(value, "interval", 1); break;
+      case 'v': config.tripSpeed = parseNumber(value, "trip speed", 0.1); break;
+      case 'p': config.pingPong = fmin(parseNumber(value, "probability", 0), 1); break;
+      case 'e': config.noiseMeters = parseNumber(value, "noise", 0); break;
+      case 'r': config.seed = strtoull(value.c_str(), nullptr, 10); break;
+      case 'd': dir = value; break;
+      case 'o': name = value; break;
+      case 'j': threads = (int)parseNumber(value, "number of threads", 1); break;
+    }
+  }
+  if (dir != ".") mkdir(dir.c_str(), 0755);
+  std::string prefix = dir == "." ? name : dir + "/" + name;
+
+  TraceGenerator generator(config);
+  std::vector<TraceTruth> truth(config.users);
+  std::vector<std::string> files(config.users);
+  for (int u = 0; u < config.users; u++)
+    files[u] = config.users == 1 ? prefix + ".csv" : prefix + "-" + std::to_string(u) + ".csv";
+
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads && t < config.users; t++) {
+    workers.push_back(std::thread([&]() {
+      for (int u = next++; u < config.users; u = next++) truth[u] = generator.writeUser(u, files[u]);
+    }));
+  }
+  for (std::thread &w : workers) w.join();
+
+  json doc;
+  long rows = 0;
+  doc["seed"] = config.seed;
+  doc["users"] = json::array();
+  for (int u = 0; u < config.users; u++) {
+    const TraceTruth &t = truth[u];
+    json user;
+    user["file"] = files[u];
+    user["rows"] = t.rows;
+    user["home"] = {{"lon", t.home.lon}, {"lat", t.home.lat}, {"tag", "CELL_" + std::to_string(t.homeTower)}};
+    user["work"] = {{"lon", t.work.lon}, {"lat", t.work.lat}, {"tag", "CELL_" + std::to_string(t.workTower)}};
+    doc["users"].push_back(user);
+    rows += t.rows;
+  }
+  std::ofstream ofs(prefix + "-truth.json");
+  ofs << doc.dump(2) << std::endl;
+  std::cout << "Wrote " << rows << " rows of " << config.users << " users." << std::endl;
+  return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file
+ * @brief Estimate the size of a data file before reading it.
+ * @details
+ * Single lines are sampled at evenly spaced offsets of the file, since neighbouring rows tend to share a cell. The number of rows is estimated from the file size
+ * and the average length of the sampled lines, and the number of distinct cells by the Chao1 estimator on the tags
+ * of the sampled lines. The estimates are used to reserve the row and cell containers up front.
+ */
+struct IngestEstimate {
+  long fileSize;
+  long rows;     // estimated number of data rows
+  long cells;    // estimated number of distinct cells
+};
+
+IngestEstimate estimateIngest(std::string filename, int probes = 256, int linesPerProbe = 1) {
+  PROFILE_STAGE("estimateIngest");
+  IngestEstimate e = {0, 0, 0};
+  std::ifstream dataSource(filename, std::ios::binary);
+  if (!dataSource) return e;
+  dataSource.seekg(0, std::ios::end);
+  e.fileSize = dataSource.tellg();
+  dataSource.seekg(0, std::ios::beg);
+
+  std::string line;
+  std::getline(dataSource, line); // the first line is a header
+  long headerBytes = line.size() + 1;
+  if (e.fileSize <= headerBytes) return e;
+
+  long sampledBytes = 0, sampledLines = 0;
+  TAGMAP tagCount;
+  for (int p = 0; p < probes; p++) {
+    dataSource.clear();
+    dataSource.seekg(headerBytes + (e.fileSize - headerBytes) * p / probes);
+    if (p > 0) std::getline(dataSource, line); // skip the partial line
+    for (int i = 0; i < linesPerProbe && std::getline(dataSource, line); i++) {
+      sampledBytes += line.size() + 1;
+      sampledLines++;
+      size_t tab = line.find_last_of('\t');
+      if (tab != std::string::npos) tagCount[ArenaString(line.data() + tab + 1, line.size() - tab - 1)]++;
+    }
+  }
+  if (sampledLines == 0) return e;
+
+  e.rows = (long)ceil((double)(e.fileSize - headerBytes) * sampledLines / sampledBytes);
+  long singletons = 0, doubletons = 0;
+  for (TAGMAP::iterator it = tagCount.begin(); it != tagCount.end(); ++it) {
+    if (it->second == 1) singletons++;
+    else if (it->second == 2) doubletons++;
+  }
+  // bias-corrected Chao1: the distinct tags seen plus an estimate of those unseen
+  e.cells = tagCount.size() + (long)ceil(singletons * (singletons - 1) / (2.0 * (doubletons + 1)));
+  if (e.cells > e.rows) e.cells = e.rows;
+  return e;
+}
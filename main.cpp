@@ -1,23 +1,33 @@
 #include "csv_parser.h"         // used for csv parsing
 #include "haversine_formula.h"  // used for calculating the great-circle distance
 #include "user.h"
+#include "options.h"            // used for command line options
+#include "batch.h"              // used for analysing the data files in parallel
+#include <sys/stat.h>
 
 /**
  * Main function:
- * Declare a user and analyse its data.
+ * Parse the command line, then declare a user for each data file and analyse its data.
  * @returns 0 on exit
  */
-int main() {
-  std::string dataFile = "data.csv";
-  double interval = 180; // seconds
-  User u(dataFile);
-  std::string targetCell = "CELL_133";
-  // std::cout << u.numConnections(targetCell) << std::endl;
-  // u.getTimeSegments(targetCell, interval);
+int main(int argc, char *argv[]) {
+  Options opt = parseOptions(argc, argv);
+  if (opt.outputDir != ".") mkdir(opt.outputDir.c_str(), 0755);
 
-  u.findResidentialAreaByTopKCells(interval);
-  u.calculateSpeedOfEachTime();
-  // u.findResidentialAreaBySpeed();
+  if (!opt.traceFile.empty()) {
+    PROFILE_TRACE_START();
+    PROFILE_THREAD("main");
+  }
 
+  std::vector<MemoryUsage> usage;
+  {
+    std::unique_ptr<MetricsWriter> metrics;
+    if (!opt.metricsFile.empty()) metrics.reset(new MetricsWriter(opt.metricsFile, opt.metricsEvery));
+    analyseBatch(opt, std::cout, usage);
+  }
+  if (opt.verbose) writeMemorySummary(opt, usage);
+  PROFILE_REPORT(std::cout);
+  if (!opt.traceFile.empty() && !PROFILE_TRACE_WRITE(opt.traceFile))
+    std::cout << "ERROR: The trace file " << opt.traceFile << " cannot be written." << std::endl;
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,71 @@
+/**
+ * @file
+ * @brief Memory accounting of the stages of an analysis.
+ * @details
+ * Every container allocating through ArenaAllocator charges its bytes to the account named by its MemoryTag
+ * (e.g. ROWLIST to the row store), in the MemoryLedger of the current thread.
+ * The ledger keeps the live and peak bytes of each account, whether the memory comes from an arena or the heap,
+ * so the peaks reflect what each stage needs rather than how the arena reuses it.
+ */
+#include <sys/resource.h>
+
+enum MemoryAccount {
+  MEMORY_OTHER,
+  MEMORY_INGEST,   // buffers of rows before they are stored (samples, sort buffers)
+  MEMORY_ROWS,     // row store of the user and of its cells
+  MEMORY_CELLS,    // cell index: tags, cell list, tag maps, cell queue
+  MEMORY_COLUMNS,  // derived columns of the AnalysisGraph
+  MEMORY_SEGMENTS, // time segments of cells and areas
+  MEMORY_OUTPUT,   // json documents of the output files
+  MEMORY_ACCOUNTS
+};
+
+// names an account as a type, to be used as the second parameter of ArenaAllocator
+template <int Account>
+struct MemoryTag {
+  enum { account = Account };
+};
+
+class MemoryLedger {
+private:
+  long live_[MEMORY_ACCOUNTS];
+  long peak_[MEMORY_ACCOUNTS];
+  long totalLive_;
+  long totalPeak_;
+
+public:
+  MemoryLedger() { reset(); };
+  void reset() {
+    for (int a = 0; a < MEMORY_ACCOUNTS; a++) live_[a] = peak_[a] = 0;
+    totalLive_ = totalPeak_ = 0;
+  };
+  void charge(int account, long bytes) {
+    live_[account] += bytes;
+    if (live_[account] > peak_[account]) peak_[account] = live_[account];
+    totalLive_ += bytes;
+    if (totalLive_ > totalPeak_) totalPeak_ = totalLive_;
+  };
+  void credit(int account, long bytes) {
+    live_[account] -= bytes;
+    totalLive_ -= bytes;
+  };
+  long live(int account) { return live_[account]; };
+  long peak(int account) { return peak_[account]; };
+  long totalPeak() { return totalPeak_; }; // the largest sum of the live bytes, at most the sum of the peaks
+
+  static const char *name(int account) {
+    static const char *names[MEMORY_ACCOUNTS] = {"other", "ingest", "rows", "cells", "columns", "segments", "output"};
+    return names[account];
+  };
+  // the ledger of the current thread
+  static MemoryLedger &current() {
+    static thread_local MemoryLedger ledger;
+    return ledger;
+  };
+  // @returns the peak resident set size of the process in bytes
+  static long peakRSS() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss * 1024L; // kilobytes on Linux
+  };
+};
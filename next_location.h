@@ -0,0 +1,240 @@
+/**
+ * @file
+ * @brief Prediction of the next area of a user from its current cell, the time of day and its last areas.
+ * @details
+ * The NextLocationIndex is an order-k Markov model over the areas of labelAreasByTopKCells. Its rows are added in
+ * the order of time; each run of rows on a cell within an hour bucket is one observation, whose context is
+ * the cell, the hour bucket and the last k areas visited (the current one last), and whose outcome is the next area,
+ * i.e. the next labelled area different from the current one. Rows outside every area (area 0) are runs like the
+ * others, so the model also predicts where a user goes from the cells between its areas.
+ * Each observation counts for every shorter context as well (the last k-1 areas, ..., no area, then the cell at any
+ * hour), and predict backs off to the longest context seen, so a rare history still gets an answer.
+ * The next areas of each context are kept sorted by count, so a prediction is a few hash lookups and a copy of the
+ * first entries, in well under a microsecond. The index is updated incrementally: add keeps the runs that wait for
+ * their next area, and save writes them with the counts, so an index loaded back continues where it stopped.
+ */
+#include <unordered_map>
+
+struct Prediction {
+  int area;
+  double probability;
+};
+
+class NextLocationIndex {
+public:
+  static const int MAX_ORDER = 4;
+
+private:
+  struct Context {
+    int cell;
+    int bucket;               // hour bucket, -1 for any hour
+    int order;                // number of areas
+    int areas[MAX_ORDER];     // last areas visited, oldest first
+    bool operator==(const Context &o) const {
+      if (cell != o.cell || bucket != o.bucket || order != o.order) return false;
+      for (int i = 0; i < order; i++) {
+        if (areas[i] != o.areas[i]) return false;
+      }
+      return true;
+    };
+  };
+  struct ContextHash {
+    size_t operator()(const Context &c) const {
+      size_t h = (size_t)c.cell * 1000003 ^ (size_t)(c.bucket + 1) * 8191 ^ (size_t)c.order;
+      for (int i = 0; i < c.order; i++) h = h * 31 + c.areas[i];
+      return h;
+    };
+  };
+  struct NextAreas {
+    long total;
+    std::vector<std::pair<int, long> > next; // next areas and their counts, by decreasing count
+  };
+
+  int order_;
+  int hoursPerBucket_;
+  std::unordered_map<std::string, int> cellIDs_;
+  std::vector<std::string> cells_;
+  std::unordered_map<Context, NextAreas, ContextHash> contexts_;
+
+  // state of the rows added so far
+  std::vector<int> history_;     // last areas visited, at most order_, the current one last
+  std::vector<Context> pending_; // runs waiting for the next area, with their longest context
+  int lastCell_;
+  int lastBucket_;
+
+  int cellID(const std::string &tag) {
+    std::pair<std::unordered_map<std::string, int>::iterator, bool> it = cellIDs_.insert(std::make_pair(tag, (int)cells_.size()));
+    if (it.second) cells_.push_back(tag);
+    return it.first->second;
+  };
+  Context context(int cell, int bucket, const std::vector<int> &areas, int order) const {
+    Context c;
+    c.cell = cell;
+    c.bucket = bucket;
+    c.order = std::min(order, (int)areas.size());
+    for (int i = 0; i < c.order; i++) c.areas[i] = areas[areas.size() - c.order + i];
+    return c;
+  };
+  void count(const Context &c, int area, long n);
+  void resolve(int area);
+
+public:
+  NextLocationIndex(int order = 2, int hoursPerBucket = 3) :
+    order_(std::max(0, std::min(order, (int)MAX_ORDER))), hoursPerBucket_(std::max(1, hoursPerBucket)),
+    lastCell_(-1), lastBucket_(-1) {};
+  void add(const std::string &cell, int area, const tm &datetime);
+  int predict(const std::string &cell, const tm &datetime, const std::vector<int> &lastAreas, Prediction *out, int k = 3) const;
+  // predict from the last areas of the rows added so far
+  int predict(const std::string &cell, const tm &datetime, Prediction *out, int k = 3) const {
+    return predict(cell, datetime, history_, out, k);
+  };
+  long numContexts() const { return contexts_.size(); };
+  bool save(std::string filename) const;
+  bool load(std::string filename);
+};
+
+// add n observations of area after context c, keeping the next areas of c sorted by count
+void NextLocationIndex::count(const Context &c, int area, long n) {
+  NextAreas &e = contexts_[c];
+  e.total += n;
+  int i = 0;
+  while (i < e.next.size() && e.next[i].first != area) i++;
+  if (i == e.next.size()) e.next.push_back(std::make_pair(area, 0L));
+  e.next[i].second += n;
+  for (; i > 0 && e.next[i].second > e.next[i - 1].second; i--) std::swap(e.next[i], e.next[i - 1]);
+}
+
+// count the pending runs in each of their contexts, with area as their next area
+void NextLocationIndex::resolve(int area) {
+  for (Context &p : pending_) {
+    Context c = p;
+    for (int o = p.order; o >= 0; o--) {
+      c.order = o;
+      for (int i = 0; i < o; i++) c.areas[i] = p.areas[p.order - o + i];
+      count(c, area, 1);
+    }
+    c.bucket = -1; // the cell at any hour
+    count(c, area, 1);
+  }
+  pending_.clear();
+}
+
+// add a row, in the order of time, on cell in area (0 for a row outside every area)
+void NextLocationIndex::add(const std::string &cell, int area, const tm &datetime) {
+  if (area > 0 && (history_.empty() || area != history_.back())) {
+    resolve(area);
+    history_.push_back(area);
+    if (history_.size() > order_) history_.erase(history_.begin());
+  }
+  int id = cellID(cell), bucket = datetime.tm_hour / hoursPerBucket_;
+  if (id == lastCell_ && bucket == lastBucket_) return; // same run
+  lastCell_ = id;
+  lastBucket_ = bucket;
+  Context c = context(id, bucket, history_, order_);
+  for (Context &p : pending_) {
+    if (p == c) return; // already waiting since the last change of area
+  }
+  pending_.push_back(c);
+}
+
+/**
+ * Predict the next areas of a user on cell at datetime, who last visited lastAreas (the current one last).
+ * Backs off to shorter contexts until one has been seen.
+ * @returns the number of predictions stored in out, at most k, the most likely first
+ */
+int NextLocationIndex::predict(const std::string &cell, const tm &datetime, const std::vector<int> &lastAreas,
+                               Prediction *out, int k) const {
+  std::unordered_map<std::string, int>::const_iterator id = cellIDs_.find(cell);
+  if (id == cellIDs_.end()) return 0;
+  int bucket = datetime.tm_hour / hoursPerBucket_, order = std::min(order_, (int)lastAreas.size());
+  int current = lastAreas.empty() ? 0 : lastAreas.back();
+  for (int o = order; o >= -1; o--) { // -1 for the cell at any hour
+    std::unordered_map<Context, NextAreas, ContextHash>::const_iterator it =
+      contexts_.find(o >= 0 ? context(id->second, bucket, lastAreas, o) : context(id->second, -1, lastAreas, 0));
+    if (it == contexts_.end()) continue;
+    // a shorter context may have seen the current area as the next one, which cannot follow it
+    long total = it->second.total;
+    for (const std::pair<int, long> &next : it->second.next) {
+      if (next.first == current) total -= next.second;
+    }
+    if (total <= 0) continue;
+    int n = 0;
+    for (int i = 0; i < it->second.next.size() && n < k; i++) {
+      if (it->second.next[i].first == current) continue;
+      out[n].area = it->second.next[i].first;
+      out[n++].probability = (double)it->second.next[i].second / total;
+    }
+    return n;
+  }
+  return 0;
+}
+
+// write the index, with the runs waiting for their next area, as json
+bool NextLocationIndex::save(std::string filename) const {
+  json doc;
+  doc["order"] = order_;
+  doc["hours_per_bucket"] = hoursPerBucket_;
+  doc["cells"] = cells_;
+  doc["contexts"] = json::array();
+  for (const std::pair<const Context, NextAreas> &e : contexts_) {
+    const Context &c = e.first;
+    doc["contexts"].push_back({c.cell, c.bucket, std::vector<int>(c.areas, c.areas + c.order), e.second.next});
+  }
+  doc["history"] = history_;
+  doc["pending"] = json::array();
+  for (const Context &c : pending_) doc["pending"].push_back({c.cell, c.bucket, std::vector<int>(c.areas, c.areas + c.order)});
+  doc["last"] = {lastCell_, lastBucket_};
+  std::ofstream ofs(filename);
+  ofs << doc.dump() << std::endl;
+  countBytesWritten(ofs.tellp());
+  ofs.close();
+  return (bool)ofs;
+}
+
+// replace the index by the one saved in filename, with its settings clamped as by the constructor,
+// @returns false if it cannot be read
+bool NextLocationIndex::load(std::string filename) {
+  std::ifstream ifs(filename);
+  if (!ifs) return false;
+  json doc;
+  try {
+    ifs >> doc;
+    order_ = std::max(0, std::min(doc["order"].get<int>(), (int)MAX_ORDER));
+    hoursPerBucket_ = std::max(1, doc["hours_per_bucket"].get<int>());
+    cells_ = doc["cells"].get<std::vector<std::string> >();
+    cellIDs_.clear();
+    for (int i = 0; i < cells_.size(); i++) cellIDs_[cells_[i]] = i;
+    contexts_.clear();
+    for (json &e : doc["contexts"]) {
+      Context c = context(e[0], e[1], e[2].get<std::vector<int> >(), MAX_ORDER);
+      for (json &next : e[3]) count(c, next[0], next[1]);
+    }
+    history_ = doc["history"].get<std::vector<int> >();
+    if (history_.size() > order_) history_.erase(history_.begin(), history_.end() - order_);
+    pending_.clear();
+    for (json &p : doc["pending"]) pending_.push_back(context(p[0], p[1], p[2].get<std::vector<int> >(), MAX_ORDER));
+    lastCell_ = doc["last"][0];
+    lastBucket_ = doc["last"][1];
+  } catch (json::exception &e) {
+    return false;
+  }
+  return true;
+}
+
+// builds the NextLocationIndex of a user: next-location.json
+class NextLocationKernel : public ScanKernel {
+private:
+  std::string prefix_;
+  NextLocationIndex index_;
+
+public:
+  NextLocationKernel(std::string prefix) : prefix_(prefix) {};
+  int needs() { return SCAN_AREA; };
+  void begin() { index_ = NextLocationIndex(); };
+  void visit(const ScanRow &r) {
+    const ArenaString &tag = r.row->getTag();
+    index_.add(std::string(tag.data(), tag.size()), r.areaID, r.row->getDateTime());
+  };
+  void end() { index_.save(prefix_ + "next-location.json"); };
+  const NextLocationIndex &index() { return index_; };
+};
@@ -0,0 +1,222 @@
+/**
+ * @file
+ * @brief Command line options of the movement trajectory analysis.
+ * @details
+ * Options select the data files, the parameters of the analyses and the outputs.
+ * Only the stages needed by the selected outputs are run (see User::analyse).
+ */
+
+// outputs about the target cell, produced by main
+enum CellOutput {
+  OUTPUT_CONNECTIONS = 64, // number of connections of the target cell
+  OUTPUT_SEGMENTS = 128    // time segments of the target cell
+};
+
+struct Options {
+  std::vector<std::string> dataFiles;
+  int interval;            // seconds
+  std::string targetCell;
+  int outputs;             // combination of Output and CellOutput flags
+  std::string outputDir;
+  int threads;
+  int sampleCapacity;      // rows per hour of data in the approximate mode, 0 to analyse every row
+  int snapshotEvery;       // rows between snapshots in the progressive mode, 0 for no snapshots
+  long memoryBudget;       // bytes of the out-of-core mode, 0 to analyse each user in memory
+  bool verbose;            // print run statistics
+  bool hugePages;          // back the arenas with huge pages
+  std::string traceFile;   // Chrome trace of the stages, written if not empty
+  std::string metricsFile; // metrics of the run, written during the run if not empty
+  int metricsEvery;        // seconds between writes of the metrics file
+  int tolerance;           // seconds between the visits of two users on a cell still counted as co-located
+};
+
+void printUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options] [data file ...]" << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  -i <seconds>   interval of time segments (default: 180)" << std::endl;
+  std::cout << "  -c <cell>      target cell of the connections and segments outputs (default: CELL_133)" << std::endl;
+  std::cout << "  -a <analyses>  comma-separated analyses, each selecting all of its outputs:" << std::endl;
+  std::cout << "                 topk, speed, byspeed (default: topk,speed)" << std::endl;
+  std::cout << "  -o <outputs>   comma-separated outputs, added to those of -a:" << std::endl;
+  std::cout << "                 area, midpoint, cdf, geo, speed, map, connections, segments, transitions," << std::endl;
+  std::cout << "                 predict, colocation" << std::endl;
+  std::cout << "  -d <dir>       directory of the output files (default: .)" << std::endl;
+  std::cout << "  -j <threads>   number of data files analysed in parallel (default: 1)" << std::endl;
+  std::cout << "  -s <rows>      approximate mode: sample up to <rows> rows per hour of data of each user" << std::endl;
+  std::cout << "  -p <rows>      progressive mode: append a snapshot of early estimates to progress.jsonl" << std::endl;
+  std::cout << "                 every <rows> rows read (not with -s)" << std::endl;
+  std::cout << "  -m <MiB>       out-of-core mode: sort the data logs within <MiB> MiB of memory, spilling" << std::endl;
+  std::cout << "                 sorted runs to the output directory; only speed, map, connections," << std::endl;
+  std::cout << "                 segments, transitions and colocation are produced; the co-location join" << std::endl;
+  std::cout << "                 also spills to disk beyond <MiB> MiB (default: 256)" << std::endl;
+  std::cout << "  -t <seconds>   tolerance of the co-location of two users on a cell (default: 300)" << std::endl;
+  std::cout << "  -v             print run statistics of each user, and write their peak memory to memory.json" << std::endl;
+  std::cout << "  -H             back the row stores and other arena memory with huge pages, if available" << std::endl;
+  std::cout << "  -T <file>      write the begin and end events of the stages of each worker to <file>, in the" << std::endl;
+  std::cout << "                 Chrome trace-event format (needs a build with -DSTAGE_PROFILE)" << std::endl;
+  std::cout << "  -M <file>      write the metrics of the run (rows, users, bytes, stage seconds, cache hits," << std::endl;
+  std::cout << "                 peak memory) to <file> in the Prometheus text format, during the run" << std::endl;
+  std::cout << "  -W <seconds>   seconds between writes of the metrics file (default: 10)" << std::endl;
+  std::cout << "  -h             show this message" << std::endl;
+  std::cout << "The data file defaults to data.csv. With several data files, the output files of each" << std::endl;
+  std::cout << "are prefixed by its name." << std::endl;
+}
+
+std::vector<std::string> splitList(std::string list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+int parseAnalyses(std::string list) {
+  int outputs = 0;
+  for (std::string &a : splitList(list)) {
+    if (a == "topk") outputs |= ANALYSIS_TOPK_CELLS;
+    else if (a == "speed") outputs |= ANALYSIS_SPEED_SERIES;
+    else if (a == "byspeed") outputs |= ANALYSIS_BY_SPEED;
+    else {
+      std::cout << "ERROR: Unknown analysis " << a << "." << std::endl;
+      exit(0);
+    }
+  }
+  return outputs;
+}
+
+int parseOutputs(std::string list) {
+  int outputs = 0;
+  for (std::string &o : splitList(list)) {
+    if (o == "area") outputs |= OUTPUT_AREA;
+    else if (o == "midpoint") outputs |= OUTPUT_MIDPOINT;
+    else if (o == "cdf") outputs |= OUTPUT_CDF;
+    else if (o == "geo") outputs |= OUTPUT_GEO;
+    else if (o == "speed") outputs |= OUTPUT_SPEED;
+    else if (o == "map") outputs |= OUTPUT_MAP;
+    else if (o == "connections") outputs |= OUTPUT_CONNECTIONS;
+    else if (o == "segments") outputs |= OUTPUT_SEGMENTS;
+    else if (o == "transitions") outputs |= OUTPUT_TRANSITIONS;
+    else if (o == "predict") outputs |= OUTPUT_PREDICTION;
+    else if (o == "colocation") outputs |= OUTPUT_COLOCATION;
+    else {
+      std::cout << "ERROR: Unknown output " << o << "." << std::endl;
+      exit(0);
+    }
+  }
+  return outputs;
+}
+
+int parsePositive(std::string value, std::string name) {
+  int n = atoi(value.c_str());
+  if (n <= 0) {
+    std::cout << "ERROR: Invalid " << name << " " << value << "." << std::endl;
+    exit(0);
+  }
+  return n;
+}
+
+// @returns the name of a file without its directory and extension
+std::string fileStem(std::string name) {
+  size_t slash = name.find_last_of('/');
+  if (slash != std::string::npos) name = name.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+  return name;
+}
+
+Options parseOptions(int argc, char *argv[]) {
+  Options opt;
+  opt.interval = 180;
+  opt.targetCell = "CELL_133";
+  opt.outputs = 0;
+  opt.outputDir = ".";
+  opt.threads = 1;
+  opt.sampleCapacity = 0;
+  opt.snapshotEvery = 0;
+  opt.memoryBudget = 0;
+  opt.verbose = false;
+  opt.hugePages = false;
+  opt.metricsEvery = 10;
+  opt.tolerance = 300;
+  bool selected = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h") {
+      printUsage(argv[0]);
+      exit(0);
+    }
+    if (arg == "-v") {
+      opt.verbose = true;
+      continue;
+    }
+    if (arg == "-H") {
+      opt.hugePages = true;
+      continue;
+    }
+    if (arg.size() == 2 && arg[0] == '-') {
+      if (std::string("icaodjspmTMWt").find(arg[1]) == std::string::npos) {
+        std::cout << "ERROR: Unknown option " << arg << "." << std::endl;
+        printUsage(argv[0]);
+        exit(0);
+      }
+      if (i + 1 >= argc) {
+        std::cout << "ERROR: Missing value of " << arg << "." << std::endl;
+        exit(0);
+      }
+      std::string value = argv[++i];
+      switch (arg[1]) {
+        case 'i': opt.interval = parsePositive(value, "interval"); break;
+        case 'c': opt.targetCell = value; break;
+        case 'a': opt.outputs |= parseAnalyses(value); selected = true; break;
+        case 'o': opt.outputs |= parseOutputs(value); selected = true; break;
+        case 'd': opt.outputDir = value; break;
+        case 'j': opt.threads = parsePositive(value, "number of threads"); break;
+        case 's': opt.sampleCapacity = parsePositive(value, "sample size"); break;
+        case 'p': opt.snapshotEvery = parsePositive(value, "number of rows between snapshots"); break;
+        case 'm': opt.memoryBudget = (long)parsePositive(value, "memory budget") << 20; break;
+        case 'T': opt.traceFile = value; break;
+        case 'M': opt.metricsFile = value; break;
+        case 'W': opt.metricsEvery = parsePositive(value, "metrics interval"); break;
+        case 't': opt.tolerance = parsePositive(value, "tolerance"); break;
+      }
+    } else {
+      opt.dataFiles.push_back(arg);
+    }
+  }
+  if (opt.memoryBudget > 0 && (opt.sampleCapacity > 0 || opt.snapshotEvery > 0)) {
+    std::cout << "ERROR: The out-of-core mode cannot be combined with -s or -p." << std::endl;
+    exit(0);
+  }
+  if (opt.sampleCapacity > 0 && opt.snapshotEvery > 0) { // sampled rows may be replaced, so they cannot be published
+    std::cout << "ERROR: The approximate mode cannot be combined with -p." << std::endl;
+    exit(0);
+  }
+#ifndef STAGE_PROFILE
+  if (!opt.traceFile.empty()) {
+    std::cout << "ERROR: The trace needs a build with -DSTAGE_PROFILE." << std::endl;
+    exit(0);
+  }
+#endif
+  if (!selected) opt.outputs = ANALYSIS_TOPK_CELLS | ANALYSIS_SPEED_SERIES;
+  if (opt.dataFiles.empty()) opt.dataFiles.push_back("data.csv");
+  if (opt.dataFiles.size() > 1) { // the output files of a user are prefixed by the name of its data file
+    std::map<std::string, std::string> stems;
+    for (std::string &file : opt.dataFiles) {
+      std::pair<std::map<std::string, std::string>::iterator, bool> it = stems.insert(std::make_pair(fileStem(file), file));
+      if (it.second) continue;
+      std::cout << "ERROR: The data files " << it.first->second << " and " << file
+                << " would write to the same output files." << std::endl;
+      exit(0);
+    }
+  }
+  return opt;
+}
+
+// @returns the prefix of the output files of the idx-th data file
+std::string outputPrefix(const Options &opt, int idx) {
+  std::string prefix = opt.outputDir == "." ? "" : opt.outputDir + "/";
+  if (opt.dataFiles.size() > 1) prefix += fileStem(opt.dataFiles[idx]) + "-";
+  return prefix;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file
+ * @brief Hardware and software performance counters of the calling thread, read through perf_event_open.
+ * @details
+ * PerfCounters opens each counter on its own rather than as a group, so a counter the machine or the kernel
+ * does not offer (e.g. hardware counters in a virtual machine, or with a high perf_event_paranoid) is left out
+ * without losing the others; read reports it as -1, and error() tells why the first one could not be opened.
+ * Counts are scaled by the time each counter was actually running, in case the kernel multiplexes them.
+ * Used by the benchmarks and the stage profile to show why a kernel is slow: instructions per cycle,
+ * cache and branch misses, page faults and context switches.
+ */
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum PerfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_REFERENCES,
+  PERF_CACHE_MISSES,
+  PERF_BRANCHES,
+  PERF_BRANCH_MISSES,
+  PERF_PAGE_FAULTS,
+  PERF_CONTEXT_SWITCHES,
+  PERF_COUNTERS
+};
+
+class PerfCounters {
+private:
+  int fd_[PERF_COUNTERS];
+  std::string error_;
+
+public:
+  PerfCounters();
+  ~PerfCounters() {
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+      if (fd_[c] >= 0) close(fd_[c]);
+    }
+  };
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+  bool available(int counter) { return fd_[counter] >= 0; };
+  const std::string &error() { return error_; };
+  void read(double *values);
+  static const char *name(int counter) {
+    static const char *names[] = {"cycles", "instructions", "cache_references", "cache_misses",
+                                  "branches", "branch_misses", "page_faults", "context_switches"};
+    return names[counter];
+  };
+};
+
+PerfCounters::PerfCounters() {
+  static const unsigned types[] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                   PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE};
+  static const unsigned long long configs[] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES};
+  for (int c = 0; c < PERF_COUNTERS; c++) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[c];
+    attr.config = configs[c];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fd_[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0); // this thread, on any cpu
+    if (fd_[c] < 0 && error_.empty()) error_ = std::string(name(c)) + ": " + strerror(errno);
+  }
+}
+
+// store the count of each counter since it was opened in values, -1 for the counters that are not available
+void PerfCounters::read(double *values) {
+  for (int c = 0; c < PERF_COUNTERS; c++) {
+    unsigned long long v[3]; // value, time enabled, time running
+    if (fd_[c] < 0 || ::read(fd_[c], v, sizeof(v)) != sizeof(v)) {
+      values[c] = -1;
+      continue;
+    }
+    values[c] = v[2] > 0 && v[2] < v[1] ? (double)v[0] * v[1] / v[2] : (double)v[0];
+  }
+}
+
+// @returns scale * a / b as text with two decimals, or n/a if a counter is not available
+std::string perfRatio(double a, double b, double scale) {
+  if (a < 0 || b <= 0) return "n/a";
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(2) << scale * a / b;
+  return ss.str();
+}
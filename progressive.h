@@ -0,0 +1,212 @@
+/**
+ * @file
+ * @brief Implementation of methods for the movement trajectory analysis.
+ * @details
+ * The ProgressiveAnalysis publishes early estimates of the top-k cells analysis while the data logs of a user are read.
+ * Every few rows, a snapshot of the top cells, the provisional residential areas and their running centroids
+ * is appended to a json lines file, each with a confidence indicator.
+ * The state of each cell is updated incrementally as rows arrive, so a snapshot never rescans the rows:
+ * 1. The stay time of a cell is estimated by the number of distinct intervals in which it is connected,
+ *    which, unlike time segments, does not depend on the order of the rows.
+ * 2. Provisional areas follow labelAreasByTopKCells: cells in the order of numConnections, with a stay time > 1 hr,
+ *    where a cell joins an existing area if their intervals overlap.
+ * 3. The running centroid of an area is the center of gravity of the unit vectors summed by its cells.
+ * Confidence indicators are the standard error of each cell's share of rows, the standard error (km) of each centroid,
+ * and the number of consecutive snapshots in which the top cells or the cells of an area have not changed.
+ */
+#include <map>
+#include <unordered_set>
+#include <sys/stat.h>
+
+class ProgressiveAnalysis {
+private:
+  struct CellState {
+    ArenaString tag;
+    long count;
+    std::unordered_set<long> intervals;  // indices of the intervals in which the cell is connected
+    double sumX, sumY, sumZ;              // sum of unit vectors
+  };
+  struct Area {
+    std::vector<int> cells;               // indices in cellList_
+    std::unordered_set<long> intervals;
+  };
+
+  int interval_;
+  long snapshotEvery_;
+  int topK_;
+  std::string filename_;
+  std::ofstream ofsProgress_;
+  double totalBytes_;
+
+  TAGMAP cellMap_;
+  std::vector<CellState> cellList_;
+  long rows_;
+  int snapshotID_;
+
+  std::vector<std::string> lastTopCells_;
+  int topCellsStable_;
+  std::map<std::string, std::pair<std::string, int> > areaHistory_; // first cell of an area -> (cells, stable snapshots)
+
+  static long secondsOf(const tm &t);
+  std::vector<Area> provisionalAreas(std::vector<int> &order);
+
+public:
+  ProgressiveAnalysis(std::string filename, int interval, long snapshotEvery, int topK = 5) :
+    interval_(interval), snapshotEvery_(snapshotEvery), topK_(topK), filename_(filename),
+    totalBytes_(0), rows_(0), snapshotID_(0), topCellsStable_(0) {};
+  void start(std::string dataFile);
+  bool add(DataRow &r);
+  void publish(double bytesRead, bool final);
+};
+
+// @returns the seconds since the epoch of t taken as UTC, without the cost of mktime
+long ProgressiveAnalysis::secondsOf(const tm &t) {
+  // days from civil, http://howardhinnant.github.io/date_algorithms.html
+  long y = t.tm_year + 1900 - (t.tm_mon < 2);
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long m = t.tm_mon + 1;
+  long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + t.tm_mday - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097 + doe - 719468;
+  return days * 86400 + t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec;
+}
+
+void ProgressiveAnalysis::start(std::string dataFile) {
+  struct stat st;
+  totalBytes_ = stat(dataFile.c_str(), &st) == 0 ? st.st_size : 0;
+  ofsProgress_.open(filename_);
+  if (!ofsProgress_) {
+    std::cout << "ERROR: The file " << filename_ << " cannot be opened." << std::endl;
+    exit(0);
+  }
+}
+
+/**
+ * Update the state of the cell of row r.
+ * @returns true if a snapshot is due.
+ */
+bool ProgressiveAnalysis::add(DataRow &r) {
+  TAGMAP::iterator it = cellMap_.find(r.getTag());
+  int idx;
+  if (it == cellMap_.end()) {
+    idx = cellList_.size();
+    cellMap_[r.getTag()] = idx;
+    CellState c = {r.getTag(), 0, std::unordered_set<long>(), 0, 0, 0};
+    cellList_.push_back(c);
+  } else {
+    idx = it->second;
+  }
+  CellState &c = cellList_[idx];
+  c.count++;
+  c.intervals.insert(secondsOf(r.getDateTime()) / interval_);
+  double lat = deg2rad(r.getLat()), lon = deg2rad(r.getLon());
+  c.sumX += cos(lat) * cos(lon);
+  c.sumY += cos(lat) * sin(lon);
+  c.sumZ += sin(lat);
+  return ++rows_ % snapshotEvery_ == 0;
+}
+
+// @returns the provisional areas, where order holds the cell indices in the order of numConnections
+std::vector<ProgressiveAnalysis::Area> ProgressiveAnalysis::provisionalAreas(std::vector<int> &order) {
+  std::vector<Area> areas;
+  for (int idx : order) {
+    CellState &c = cellList_[idx];
+    if (c.count < 3600 / interval_) break;
+    if (c.intervals.size() * interval_ <= 3600) continue; // stay time <= 1 hr
+    bool merged = false;
+    for (Area &a : areas) {
+      bool overlapped = false;
+      for (long i : c.intervals) {
+        if (a.intervals.count(i) > 0) {
+          overlapped = true;
+          break;
+        }
+      }
+      if (overlapped) {
+        a.cells.push_back(idx);
+        a.intervals.insert(c.intervals.begin(), c.intervals.end());
+        merged = true;
+        break;
+      }
+    }
+    if (!merged) {
+      Area a;
+      a.cells.push_back(idx);
+      a.intervals = c.intervals;
+      areas.push_back(a);
+    }
+  }
+  return areas;
+}
+
+/**
+ * Append a snapshot of the current estimates to the progress file.
+ * bytesRead is the position in the data file, used for the progress of the snapshot.
+ */
+void ProgressiveAnalysis::publish(double bytesRead, bool final) {
+  std::vector<int> order(cellList_.size());
+  for (int i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [this](int a, int b) {
+    return cellList_[a].count > cellList_[b].count;
+  });
+
+  json snapshot;
+  snapshot["snapshot"] = ++snapshotID_;
+  snapshot["final"] = final;
+  snapshot["rows"] = rows_;
+  snapshot["progress"] = final ? 1.0 : (totalBytes_ > 0 ? fmin(bytesRead / totalBytes_, 1.0) : 0.0);
+
+  // top cells, with the standard error of their share of rows
+  std::vector<std::string> topCells;
+  snapshot["topCells"] = json::array();
+  for (int i = 0; i < order.size() && i < topK_; i++) {
+    CellState &c = cellList_[order[i]];
+    double share = (double)c.count / rows_;
+    topCells.push_back(c.tag.c_str());
+    snapshot["topCells"].push_back({{"tag", c.tag.c_str()}, {"count", c.count}, {"share", share},
+                                    {"shareStdError", sqrt(share * (1 - share) / rows_)}});
+  }
+  std::vector<std::string> sortedTop = topCells;
+  std::sort(sortedTop.begin(), sortedTop.end());
+  topCellsStable_ = sortedTop == lastTopCells_ ? topCellsStable_ + 1 : 0;
+  lastTopCells_ = sortedTop;
+  snapshot["topCellsStable"] = topCellsStable_;
+
+  // provisional areas, with the standard error (km) of their running centroids
+  std::vector<Area> areas = provisionalAreas(order);
+  std::map<std::string, std::pair<std::string, int> > history;
+  snapshot["areas"] = json::array();
+  for (int i = 0; i < areas.size(); i++) {
+    json cells = json::array();
+    std::string members;
+    long count = 0;
+    double x = 0, y = 0, z = 0;
+    for (int idx : areas[i].cells) {
+      CellState &c = cellList_[idx];
+      cells.push_back(c.tag.c_str());
+      members += c.tag.c_str();
+      members += ",";
+      count += c.count;
+      x += c.sumX;
+      y += c.sumY;
+      z += c.sumZ;
+    }
+    double lat = rad2deg(atan2(z, sqrt(x * x + y * y)));
+    double lon = rad2deg(atan2(y, x));
+    double resultant = fmin(sqrt(x * x + y * y + z * z) / count, 1.0); // mean resultant length
+    double dispersion = earthRadiusKm * sqrt(2 * (1 - resultant));     // RMS distance from the centroid
+    std::string lead = cellList_[areas[i].cells[0]].tag.c_str();
+    std::map<std::string, std::pair<std::string, int> >::iterator h = areaHistory_.find(lead);
+    int stable = (h != areaHistory_.end() && h->second.first == members) ? h->second.second + 1 : 0;
+    history[lead] = std::make_pair(members, stable);
+
+    snapshot["areas"].push_back({{"areaID", i + 1}, {"cells", cells}, {"rows", count},
+                                 {"stayTime", areas[i].intervals.size() * interval_},
+                                 {"centroid", {lat, lon}}, {"centroidStdErrorKm", dispersion / sqrt(count)},
+                                 {"stable", stable}});
+  }
+  areaHistory_ = history;
+
+  ofsProgress_ << snapshot.dump() << std::endl; // flushed so that readers see each snapshot at once
+}
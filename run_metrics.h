@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief Metrics of a batch run, exported as a text file in the format of the node exporter's textfile collector.
+ * @details
+ * RunMetrics keeps process-wide counters (rows parsed and skipped, users, bytes read and written, seconds of
+ * the stages, hits of the column cache), updated with relaxed atomic adds. Hot loops add their rows in blocks,
+ * so the counters cost nothing measurable. A MetricsWriter thread writes them every few seconds while the batch
+ * runs, and once more when it is done: each write goes to a temporary file renamed over the metrics file,
+ * so a scraper never reads a partial file.
+ */
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+class RunMetrics {
+public:
+  std::atomic<long> rowsParsed;
+  std::atomic<long> rowsSkipped;   // rows left out of the sample in the approximate mode
+  std::atomic<long> users;         // users of the batch
+  std::atomic<long> usersDone;
+  std::atomic<long> bytesIn;       // bytes of the data files read
+  std::atomic<long> bytesOut;      // bytes of the output files written
+  std::atomic<long> readNanos;     // reading and sorting the data files
+  std::atomic<long> analyseNanos;  // analyses and their outputs
+  std::atomic<long> columnHits;    // derived columns of the AnalysisGraph served without computing them
+  std::atomic<long> columnMisses;
+  std::atomic<long> peakBytes;     // largest memory required by a user, see MemoryUsage::requiredBytes
+
+  RunMetrics() : rowsParsed(0), rowsSkipped(0), users(0), usersDone(0), bytesIn(0), bytesOut(0), readNanos(0),
+                 analyseNanos(0), columnHits(0), columnMisses(0), peakBytes(0) {};
+  static RunMetrics &global() {
+    static RunMetrics m;
+    return m;
+  };
+  void add(std::atomic<long> &counter, long n) { counter.fetch_add(n, std::memory_order_relaxed); };
+  void raise(std::atomic<long> &gauge, long n) {
+    for (long v = gauge.load(); v < n && !gauge.compare_exchange_weak(v, n);) {}
+  };
+  bool write(const std::string &filename, bool done);
+};
+
+// add the bytes of an output file to the run metrics and to the current stage of the profile
+void countBytesWritten(long n) {
+  RunMetrics::global().add(RunMetrics::global().bytesOut, n);
+  PROFILE_BYTES(n);
+}
+
+// write the metrics to filename, through a temporary file renamed over it
+bool RunMetrics::write(const std::string &filename, bool done) {
+  std::string tmp = filename + ".tmp";
+  std::ofstream ofs(tmp);
+  if (!ofs) return false;
+  // one metric, with its help and type
+  auto metric = [&ofs](const char *name, const char *type, const char *help, double value) {
+    ofs << "# HELP trajectory_" << name << " " << help << "\n# TYPE trajectory_" << name << " " << type
+        << "\ntrajectory_" << name << " " << value << "\n";
+  };
+  ofs.precision(15);
+  metric("rows_parsed_total", "counter", "Rows parsed from the data files.", rowsParsed);
+  metric("rows_skipped_total", "counter", "Rows left out of the sample of the approximate mode.", rowsSkipped);
+  metric("users", "gauge", "Users (data files) of the batch.", users);
+  metric("users_processed_total", "counter", "Users analysed.", usersDone);
+  metric("bytes_read_total", "counter", "Bytes of the data files read.", bytesIn);
+  metric("bytes_written_total", "counter", "Bytes of the output files written.", bytesOut);
+  ofs << "# HELP trajectory_stage_seconds_total Seconds spent in each stage, summed over the workers.\n"
+      << "# TYPE trajectory_stage_seconds_total counter\n"
+      << "trajectory_stage_seconds_total{stage=\"read\"} " << readNanos * 1e-9 << "\n"
+      << "trajectory_stage_seconds_total{stage=\"analyse\"} " << analyseNanos * 1e-9 << "\n";
+#ifdef STAGE_PROFILE
+  // the workers grow their trees of stages without a lock, so these are only read once the batch is done
+  if (done) {
+    for (std::pair<std::string, double> &stage : StageProfile::seconds())
+      ofs << "trajectory_stage_seconds_total{stage=\"profile/" << stage.first << "\"} " << stage.second << "\n";
+  }
+#endif
+  long lookups = columnHits + columnMisses;
+  metric("column_cache_hits_total", "counter", "Derived columns served from the cache of the analysis graph.", columnHits);
+  metric("column_cache_misses_total", "counter", "Derived columns computed by the analysis graph.", columnMisses);
+  metric("column_cache_hit_ratio", "gauge", "Share of the derived columns served from the cache.",
+         lookups > 0 ? (double)columnHits / lookups : 0);
+  metric("user_peak_bytes", "gauge", "Largest memory required by a user: its arena high-water mark, or its peak live bytes out of core.", peakBytes);
+  metric("peak_rss_bytes", "gauge", "Peak resident set size of the process.", MemoryLedger::peakRSS());
+  metric("done", "gauge", "1 once the batch is done.", done ? 1 : 0);
+  metric("last_update_seconds", "gauge", "Time of this update, in seconds since the epoch.", time(nullptr));
+  ofs.close();
+  return ofs && rename(tmp.c_str(), filename.c_str()) == 0;
+}
+
+// writes the run metrics to a file every few seconds, and once more when it is destroyed
+class MetricsWriter {
+private:
+  std::string filename_;
+  int seconds_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+
+public:
+  MetricsWriter(std::string filename, int seconds) : filename_(filename), seconds_(seconds), stop_(false) {
+    thread_ = std::thread([this]() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!wake_.wait_for(lock, std::chrono::seconds(seconds_), [this]() { return stop_; }))
+        RunMetrics::global().write(filename_, false);
+    });
+  };
+  ~MetricsWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    if (!RunMetrics::global().write(filename_, true))
+      std::cout << "ERROR: The metrics file " << filename_ << " cannot be written." << std::endl;
+  };
+};
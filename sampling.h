@@ -0,0 +1,233 @@
+/**
+ * @file
+ * @brief Implementation of methods for the movement trajectory analysis.
+ * @details
+ * The StratifiedReservoir keeps a time-stratified sample of the data logs of a user, used by the approximate mode.
+ * Each hour of data is a stratum with its own reservoir of up to capacity rows (Algorithm R), so the sample
+ * covers the whole time range of the user however the rows are ordered in the file.
+ * Rows are offered by their datetime before being parsed further, so skipped rows cost only the timestamp parsing.
+ * Values of consecutive rows, e.g. the speed between them, are estimated over sampled pairs. Once the file is read,
+ * finalize sorts the sampled rows by (second, line), and a second pass offers every row to offerPredecessor, which
+ * finds the first sampled row after it by binary search and keeps it if it is the latest row before that one.
+ * Only the state of the sampled rows is kept, so memory stays in the size of the sample.
+ * The stratified estimators weight each sampled row (or pair) by N_h / n_h and report their standard errors.
+ */
+#include <algorithm>
+#include <map>
+
+struct Estimate {
+  double value;
+  double stdError;
+};
+
+class StratifiedReservoir {
+private:
+  struct Stratum {
+    long seen;
+    std::vector<DataRow, IngestAllocator<DataRow> > rows;
+    std::vector<long, IngestAllocator<long> > lines;           // of rows[i] in the file, 0 for the first row
+    std::vector<DataRow, IngestAllocator<DataRow> > previous;  // the row before rows[i] in the order of time
+    std::vector<bool> hasPrevious;
+    Stratum() : seen(0) {};
+  };
+  int capacity_;            // rows per stratum
+  std::map<long, Stratum> strata_;
+  Stratum *pending_;        // stratum of the last offered row
+  // a sampled row and the latest row before it in the order of time offered so far, by (second, line)
+  struct SampledRow {
+    long long second;
+    long line;
+    Stratum *stratum;
+    int slot;
+    long long previousSecond;
+    long previousLine; // -1 until a row before it is offered
+  };
+  unsigned long long rng_;  // xorshift64 state
+  long seen_;
+  std::vector<SampledRow, IngestAllocator<SampledRow> > sampledRows_; // sorted by finalize
+
+  static long long secondOf(const tm &t) { return stratumOf(t) * 3600LL + t.tm_min * 60 + t.tm_sec; };
+  Estimate estimate(const std::vector<std::pair<long, double> > &values);
+
+  unsigned long long nextRandom() {
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 7;
+    rng_ ^= rng_ << 17;
+    return rng_;
+  };
+
+public:
+  StratifiedReservoir(int capacity, unsigned long long seed = 88172645463325252ULL) :
+    capacity_(capacity), pending_(nullptr), rng_(seed ? seed : 1), seen_(0) {};
+  static long stratumOf(const tm &t) {
+    return (((t.tm_year * 12L + t.tm_mon) * 31 + t.tm_mday - 1) * 24) + t.tm_hour;
+  };
+  int offer(const tm &t);
+  void place(int slot, const DataRow &d);
+  void finalize();
+  int offerPredecessor(long line, const tm &t);
+  void placePredecessor(int slot, const DataRow &d);
+  ROWLIST rows();
+  long seen() { return seen_; };
+  long sampled();
+  int numStrata() { return strata_.size(); };
+  double weight(const tm &t);
+  Estimate estimateMean(ROWLIST &rows, const COLUMN<double> &x);
+  Estimate estimatePairMean(std::function<double(DataRow &, DataRow &)> f);
+};
+
+/**
+ * Offer a row of the user by its datetime.
+ * @returns the slot taking the row in its stratum (to be filled by place), or -1 if the row is not sampled.
+ */
+int StratifiedReservoir::offer(const tm &t) {
+  seen_++;
+  pending_ = &strata_[stratumOf(t)];
+  long seen = ++pending_->seen;
+  if (pending_->rows.size() < capacity_) return pending_->rows.size();
+  unsigned long long j = nextRandom() % seen;
+  return j < capacity_ ? (int)j : -1;
+}
+
+void StratifiedReservoir::place(int slot, const DataRow &d) {
+  if (slot == pending_->rows.size()) {
+    pending_->rows.push_back(d);
+    pending_->lines.push_back(seen_ - 1);
+    pending_->previous.push_back(d);
+    pending_->hasPrevious.push_back(false);
+  } else {
+    pending_->rows[slot] = d;
+    pending_->lines[slot] = seen_ - 1;
+  }
+}
+
+// sort the sampled rows by (second, line) once every row has been offered, for offerPredecessor
+void StratifiedReservoir::finalize() {
+  sampledRows_.clear();
+  sampledRows_.reserve(sampled());
+  for (std::map<long, Stratum>::iterator it = strata_.begin(); it != strata_.end(); ++it) {
+    Stratum &s = it->second;
+    for (int i = 0; i < s.rows.size(); i++) {
+      SampledRow r = {secondOf(s.rows[i].getDateTime()), s.lines[i], &s, i, 0, -1};
+      sampledRows_.push_back(r);
+      s.hasPrevious[i] = false;
+    }
+  }
+  std::sort(sampledRows_.begin(), sampledRows_.end(), [](const SampledRow &a, const SampledRow &b) {
+    return a.second < b.second || (a.second == b.second && a.line < b.line);
+  });
+}
+
+/**
+ * Offer the row at line of the file, with datetime t, as the predecessor of the first sampled row after it
+ * in the order of time (rows of the same second in the order of the file).
+ * @returns the slot of that sampled row if the row is the latest before it so far (to be filled by
+ * placePredecessor), or -1
+ */
+int StratifiedReservoir::offerPredecessor(long line, const tm &t) {
+  long long second = secondOf(t);
+  std::vector<SampledRow, IngestAllocator<SampledRow> >::iterator next =
+    std::upper_bound(sampledRows_.begin(), sampledRows_.end(), std::make_pair(second, line),
+                     [](const std::pair<long long, long> &key, const SampledRow &r) {
+                       return key.first < r.second || (key.first == r.second && key.second < r.line);
+                     });
+  if (next == sampledRows_.end()) return -1;
+  if (next->previousLine >= 0 &&
+      (second < next->previousSecond || (second == next->previousSecond && line < next->previousLine))) return -1;
+  next->previousSecond = second;
+  next->previousLine = line;
+  return next - sampledRows_.begin();
+}
+
+void StratifiedReservoir::placePredecessor(int slot, const DataRow &d) {
+  SampledRow &r = sampledRows_[slot];
+  r.stratum->previous[r.slot] = d;
+  r.stratum->hasPrevious[r.slot] = true;
+}
+
+// @returns the sampled rows of every stratum, in the order of the strata
+ROWLIST StratifiedReservoir::rows() {
+  ROWLIST sample;
+  sample.reserve(sampled());
+  for (std::map<long, Stratum>::iterator it = strata_.begin(); it != strata_.end(); ++it)
+    sample.insert(sample.end(), it->second.rows.begin(), it->second.rows.end());
+  return sample;
+}
+
+long StratifiedReservoir::sampled() {
+  long n = 0;
+  for (std::map<long, Stratum>::iterator it = strata_.begin(); it != strata_.end(); ++it)
+    n += it->second.rows.size();
+  return n;
+}
+
+// @returns the number of rows of the user represented by a sampled row with datetime t (N_h / n_h)
+double StratifiedReservoir::weight(const tm &t) {
+  std::map<long, Stratum>::iterator it = strata_.find(stratumOf(t));
+  if (it == strata_.end() || it->second.rows.empty()) return 0;
+  return (double)it->second.seen / it->second.rows.size();
+}
+
+// Stratified estimate of the mean of x over all rows of the user, where x[i] is the value of the sampled row rows[i].
+Estimate StratifiedReservoir::estimateMean(ROWLIST &rows, const COLUMN<double> &x) {
+  std::vector<std::pair<long, double> > values;
+  for (int i = 0; i < rows.size(); i++) values.push_back(std::make_pair(stratumOf(rows[i].getDateTime()), x[i]));
+  return estimate(values);
+}
+
+/**
+ * Stratified estimate of the mean of f(previous row, row) over all pairs of consecutive rows of the user,
+ * from the sampled rows and their predecessors; the stratum of a pair is that of its second row.
+ */
+Estimate StratifiedReservoir::estimatePairMean(std::function<double(DataRow &, DataRow &)> f) {
+  std::vector<std::pair<long, double> > values;
+  for (std::map<long, Stratum>::iterator it = strata_.begin(); it != strata_.end(); ++it) {
+    Stratum &s = it->second;
+    for (int i = 0; i < s.rows.size(); i++)
+      values.push_back(std::make_pair(it->first, s.hasPrevious[i] ? f(s.previous[i], s.rows[i]) : NAN));
+  }
+  return estimate(values);
+}
+
+/**
+ * Stratified estimate of the mean of the values of sampled units, each given with its stratum.
+ * Units with a NaN value are out of the domain of the mean; each stratum is then weighted by its estimated domain size.
+ * Var = sum_h W_h^2 (1 - n_h / N_h) s_h^2 / n_h
+ */
+Estimate StratifiedReservoir::estimate(const std::vector<std::pair<long, double> > &values) {
+  struct Moments { long n; double sum, sumSq; };
+  std::map<long, Moments> moments;
+  for (const std::pair<long, double> &v : values) {
+    if (std::isnan(v.second)) continue;
+    Moments &m = moments[v.first];
+    m.n++;
+    m.sum += v.second;
+    m.sumSq += v.second * v.second;
+  }
+
+  double domainSize = 0;
+  std::map<long, double> domainOf; // estimated N_h of the domain
+  for (std::map<long, Moments>::iterator it = moments.begin(); it != moments.end(); ++it) {
+    Stratum &s = strata_[it->first];
+    domainOf[it->first] = (double)s.seen * it->second.n / s.rows.size();
+    domainSize += domainOf[it->first];
+  }
+
+  Estimate e = {0, 0};
+  if (domainSize == 0) return e;
+  double variance = 0;
+  for (std::map<long, Moments>::iterator it = moments.begin(); it != moments.end(); ++it) {
+    Moments &m = it->second;
+    Stratum &s = strata_[it->first];
+    double w = domainOf[it->first] / domainSize;
+    double mean = m.sum / m.n;
+    e.value += w * mean;
+    if (m.n > 1) {
+      double s2 = (m.sumSq - m.n * mean * mean) / (m.n - 1);
+      double fpc = 1 - (double)s.rows.size() / s.seen; // finite population correction
+      variance += w * w * fpc * fmax(s2, 0) / m.n;
+    }
+  }
+  e.stdError = sqrt(variance);
+  return e;
+}
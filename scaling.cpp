@@ -0,0 +1,230 @@
+#include "csv_parser.h"         // used for csv parsing
+#include "haversine_formula.h"  // used for calculating the great-circle distance
+#include "user.h"
+#include "options.h"            // used for the options of the analysis
+#include "batch.h"              // used for analysing the data files in parallel
+#include "trace_generator.h"    // used for generating the data files
+#include <iomanip>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// result of one run of the batch
+struct ScalingRun {
+  double wall;          // seconds
+  long peakRSS;         // bytes, of the process of the run
+  json stagePeak;       // peak live bytes of each stage, the largest over the users
+  long arenaHighWater;  // bytes, the largest over the users
+  long required;        // bytes to size a worker, the largest over the users
+  json stageSeconds;    // seconds of each stage by its path, in a build with -DSTAGE_PROFILE
+};
+
+/**
+ * Analyse the data files of opt in a child process, so the peak RSS of each run is measured on its own.
+ * The child sends its wall time and memory ledgers to the parent through a pipe.
+ */
+ScalingRun runBatch(const Options &opt) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    std::cout << "ERROR: The pipe cannot be created." << std::endl;
+    exit(0);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    std::ofstream devNull("/dev/null");
+    std::vector<MemoryUsage> usage;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    analyseBatch(opt, devNull, usage);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    json result;
+    result["wall"] = wall;
+    long arena = 0;
+    long required = 0;
+    for (MemoryUsage &u : usage) {
+      arena = std::max(arena, (long)u.arenaHighWater);
+      required = std::max(required, u.requiredBytes());
+    }
+    result["arena"] = arena;
+    result["required"] = required;
+    for (int a = 0; a < MEMORY_ACCOUNTS; a++) {
+      long peak = 0;
+      for (MemoryUsage &u : usage) peak = std::max(peak, (long)u.stages.peak(a));
+      result["stages"][MemoryLedger::name(a)] = peak;
+    }
+#ifdef STAGE_PROFILE
+    for (std::pair<std::string, double> &stage : StageProfile::seconds()) result["stage_seconds"][stage.first] = stage.second;
+#endif
+    std::string s = result.dump();
+    for (size_t done = 0; done < s.size();) {
+      ssize_t n = write(fds[1], s.data() + done, s.size() - done);
+      if (n <= 0) _exit(1);
+      done += n;
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  std::string s;
+  char buf[4096];
+  for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0;) s.append(buf, n);
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    std::cout << "ERROR: A run of the benchmark failed." << std::endl;
+    exit(0);
+  }
+  json result = json::parse(s);
+  ScalingRun run = {result["wall"], usage.ru_maxrss * 1024L, result["stages"], result["arena"], result["required"], result["stage_seconds"]};
+  return run;
+}
+
+std::vector<int> parseList(std::string list, std::string name) {
+  std::vector<int> values;
+  for (std::string &item : splitList(list)) values.push_back(parsePositive(item, name));
+  if (values.empty()) {
+    std::cout << "ERROR: Invalid " << name << " " << list << "." << std::endl;
+    exit(0);
+  }
+  return values;
+}
+
+void printScalingUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options]" << std::endl;
+  std::cout << "Run the whole analysis over generated data files of increasing size, with increasing numbers of threads." << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  -u <users>     number of users (data files) of each batch (default: 8)" << std::endl;
+  std::cout << "  -n <days>      comma-separated days of data of each user, one size of input each (default: 1,2,4)" << std::endl;
+  std::cout << "  -j <threads>   comma-separated numbers of threads (default: 1,2,4)" << std::endl;
+  std::cout << "  -r <reps>      runs of each size and number of threads (default: 3)" << std::endl;
+  std::cout << "  -a <analyses>  comma-separated analyses: topk, speed, byspeed (default: topk,speed,byspeed)" << std::endl;
+  std::cout << "  -d <dir>       directory of the data and output files (default: scaling-scratch)" << std::endl;
+  std::cout << "  -o <file>      write the results as json to <file>" << std::endl;
+  std::cout << "  -H             back the arenas with huge pages, if available" << std::endl;
+  std::cout << "  -h             show this message" << std::endl;
+}
+
+/**
+ * Main function:
+ * Parse the command line, generate the data files of each size, then time the batch with each number of threads.
+ * The wall time of a configuration is the median of its runs, and its peak RSS the largest.
+ * @returns 0 on exit
+ */
+int main(int argc, char *argv[]) {
+  int users = 8, reps = 3;
+  std::vector<int> days = {1, 2, 4}, threads = {1, 2, 4};
+  std::string dir = "scaling-scratch", jsonFile, analyses = "topk,speed,byspeed";
+  bool hugePages = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h") {
+      printScalingUsage(argv[0]);
+      return 0;
+    }
+    if (arg == "-H") {
+      hugePages = true;
+      continue;
+    }
+    if (arg.size() != 2 || arg[0] != '-' || std::string("unjrado").find(arg[1]) == std::string::npos) {
+      std::cout << "ERROR: Unknown option " << arg << "." << std::endl;
+      printScalingUsage(argv[0]);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      std::cout << "ERROR: Missing value of " << arg << "." << std::endl;
+      return 0;
+    }
+    std::string value = argv[++i];
+    switch (arg[1]) {
+      case 'u': users = parsePositive(value, "number of users"); break;
+      case 'n': days = parseList(value, "number of days"); break;
+      case 'j': threads = parseList(value, "number of threads"); break;
+      case 'r': reps = parsePositive(value, "number of runs"); break;
+      case 'a': analyses = value; break;
+      case 'd': dir = value; break;
+      case 'o': jsonFile = value; break;
+    }
+  }
+  int outputs = parseAnalyses(analyses);
+  mkdir(dir.c_str(), 0755);
+
+  json doc;
+  doc["users"] = users;
+  doc["analyses"] = analyses;
+  doc["repetitions"] = reps;
+  doc["hardware_threads"] = std::thread::hardware_concurrency();
+  doc["runs"] = json::array();
+  std::cout << std::setw(6) << "days" << std::setw(10) << "rows" << std::setw(9) << "threads" << std::setw(11) << "wall s"
+            << std::setw(12) << "rows/s" << std::setw(9) << "speedup" << std::setw(13) << "peak RSS MiB" << std::endl;
+  for (int d : days) {
+    TraceConfig config = TraceConfig::defaults(); // the same traces as the generator, with users and days set
+    config.users = users;
+    config.days = d;
+    TraceGenerator generator(config);
+    Options opt;
+    opt.interval = 180;
+    opt.targetCell = "CELL_133";
+    opt.outputs = outputs;
+    opt.sampleCapacity = 0;
+    opt.snapshotEvery = 0;
+    opt.memoryBudget = 0;
+    opt.verbose = false;
+    opt.hugePages = hugePages;
+    opt.metricsEvery = 10;
+    opt.tolerance = 300;
+    opt.outputDir = dir + "/out";
+    mkdir(opt.outputDir.c_str(), 0755);
+    long rows = 0;
+    for (int u = 0; u < users; u++) {
+      opt.dataFiles.push_back(dir + "/trace-" + std::to_string(u) + ".csv");
+      rows += generator.writeUser(u, opt.dataFiles.back()).rows;
+    }
+
+    double baseWall = 0;
+    for (int t : threads) {
+      opt.threads = t;
+      std::vector<double> walls;
+      json stageSamples = json::object();
+      ScalingRun peak = {0, 0, json(), 0, 0, json()};
+      for (int r = 0; r < reps; r++) {
+        ScalingRun run = runBatch(opt);
+        walls.push_back(run.wall);
+        for (json::iterator it = run.stageSeconds.begin(); it != run.stageSeconds.end(); ++it)
+          stageSamples[it.key()].push_back(it.value());
+        if (run.peakRSS >= peak.peakRSS) peak = run;
+      }
+      std::sort(walls.begin(), walls.end());
+      double wall = reps % 2 ? walls[reps / 2] : (walls[reps / 2 - 1] + walls[reps / 2]) / 2;
+      if (baseWall == 0) baseWall = wall;
+
+      json run;
+      run["days"] = d;
+      run["rows"] = rows;
+      run["threads"] = t;
+      run["wall_s"] = wall;
+      run["wall_s_min"] = walls.front();
+      run["wall_s_max"] = walls.back();
+      run["wall_samples_s"] = walls;
+      run["rows_per_s"] = rows / wall;
+      run["speedup"] = baseWall / wall;
+      run["peak_rss_bytes"] = peak.peakRSS;
+      run["arena_high_water_bytes"] = peak.arenaHighWater;
+      run["required_bytes"] = peak.required;
+      run["stage_peak_live_bytes"] = peak.stagePeak;
+      if (!stageSamples.empty()) run["stage_samples_s"] = stageSamples;
+      doc["runs"].push_back(run);
+      std::cout << std::setw(6) << d << std::setw(10) << rows << std::setw(9) << t << std::fixed << std::setprecision(3)
+                << std::setw(11) << wall << std::setprecision(0) << std::setw(12) << rows / wall << std::setprecision(2)
+                << std::setw(8) << baseWall / wall << "x" << std::setprecision(1) << std::setw(13) << peak.peakRSS / 1048576.0
+                << std::endl;
+      std::cout.unsetf(std::ios::fixed);
+    }
+  }
+  if (!jsonFile.empty()) {
+    std::ofstream ofs(jsonFile);
+    ofs << doc.dump(2) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file
+ * @brief Implementation of methods for the movement trajectory analysis.
+ * @details
+ * The ScanEngine feeds the sorted data logs of a user to several ScanKernels in a single pass.
+ * Values shared by the kernels (time value, distance and time difference from the previous row, areaID)
+ * are only looked up if a registered kernel needs them, and are computed per row in the pass feeding the kernels.
+ * In memory, run reads a value from the column of the AnalysisGraph of the rows instead if an earlier analysis
+ * has already computed it (e.g. the areaID labelled for the midpoints), and never computes a whole column.
+ * A stream of rows, e.g. from an ExternalSorter, is pushed row by row.
+ */
+
+enum ScanNeeds {
+  SCAN_TIME = 1,
+  SCAN_PAIR = 2 | SCAN_TIME, // pairDistance and pairTimeDiff
+  SCAN_AREA = 4
+};
+
+// The current row and its relation to the previous row
+struct ScanRow {
+  long index;
+  DataRow *row;
+  time_t time;
+  double pairDistance; // km from the previous row, 0 for the first row
+  double pairTimeDiff; // seconds from the previous row, 0 for the first row
+  int areaID;
+};
+
+class ScanKernel {
+public:
+  virtual ~ScanKernel() {};
+  virtual int needs() { return 0; };
+  virtual void begin() {};
+  virtual void visit(const ScanRow &r) = 0;
+  virtual void end() {};
+};
+
+class ScanEngine {
+private:
+  std::vector<ScanKernel *> kernels_;
+  std::function<int(DataRow &)> areaOf_;
+  int needs_;
+  ScanRow curr_;
+  double prevLat_, prevLon_;
+
+  void computeTime(DataRow &row);
+  void computePair(DataRow &row);
+  void computeArea(DataRow &row);
+
+public:
+  ScanEngine() : needs_(0) {};
+  void add(ScanKernel *kernel) {
+    kernels_.push_back(kernel);
+    needs_ |= kernel->needs();
+  };
+  void setAreaLabeler(std::function<int(DataRow &)> areaOf) { areaOf_ = areaOf; };
+  bool empty() { return kernels_.empty(); };
+  void begin();
+  void push(DataRow &row);
+  void end();
+  void run(AnalysisGraph &graph);
+};
+
+void ScanEngine::begin() {
+  if ((needs_ & SCAN_AREA) && !areaOf_) {
+    std::cout << "ERROR: Areas have not been labelled." << std::endl;
+    exit(0);
+  }
+  curr_.index = -1;
+  for (ScanKernel *k : kernels_) k->begin();
+}
+
+// time of row and its difference from the previous row
+void ScanEngine::computeTime(DataRow &row) {
+  time_t t = getTimeValue(row.getDateTime());
+  curr_.pairTimeDiff = curr_.index == 0 ? 0 : difftime(t, curr_.time);
+  curr_.time = t;
+  if (curr_.pairTimeDiff < 0) {
+    std::cout << "ERROR: timeDiff < 0. " << curr_.pairTimeDiff << std::endl;
+    exit(0);
+  }
+}
+
+// distance of row from the previous row
+void ScanEngine::computePair(DataRow &row) {
+  curr_.pairDistance = curr_.index == 0 ? 0 : distanceEarth(prevLat_, prevLon_, row.getLat(), row.getLon());
+  prevLat_ = row.getLat();
+  prevLon_ = row.getLon();
+}
+
+void ScanEngine::computeArea(DataRow &row) {
+  curr_.areaID = areaOf_(row);
+  row.setAreaID(curr_.areaID);
+}
+
+void ScanEngine::push(DataRow &row) {
+  curr_.index++;
+  curr_.row = &row;
+  if (needs_ & SCAN_TIME) computeTime(row);
+  if ((needs_ & SCAN_PAIR) == SCAN_PAIR) computePair(row);
+  if (needs_ & SCAN_AREA) computeArea(row);
+  for (ScanKernel *k : kernels_) k->visit(curr_);
+}
+
+void ScanEngine::end() {
+  for (ScanKernel *k : kernels_) k->end();
+}
+
+/**
+ * Scan the rows of graph in one pass, labelling them with the area labeler of graph.
+ * The values of the kernels are computed inline as by push, or read from a column of graph already computed.
+ */
+void ScanEngine::run(AnalysisGraph &graph) {
+  PROFILE_STAGE("scan");
+  ROWLIST &rowList = graph.rows();
+  PROFILE_ROWS(rowList.size());
+  const COLUMN<time_t> *time = nullptr;
+  const COLUMN<double> *timeDiff = nullptr, *distance = nullptr;
+  const COLUMN<int> *areaID = nullptr;
+  if ((needs_ & SCAN_TIME) && graph.timeReady()) {
+    time = &graph.time();
+    timeDiff = &graph.pairTimeDiff();
+  }
+  if ((needs_ & SCAN_PAIR) == SCAN_PAIR && graph.pairDistanceReady()) distance = &graph.pairDistance();
+  if ((needs_ & SCAN_AREA) && graph.areaIDReady()) areaID = &graph.areaID();
+  areaOf_ = graph.areaLabeler();
+  begin();
+  for (long i = 0; i < rowList.size(); i++) {
+    DataRow &row = rowList[i];
+    curr_.index = i;
+    curr_.row = &row;
+    if (time) {
+      curr_.time = (*time)[i];
+      curr_.pairTimeDiff = (*timeDiff)[i];
+    } else if (needs_ & SCAN_TIME) {
+      computeTime(row);
+    }
+    if (distance) curr_.pairDistance = (*distance)[i];
+    else if ((needs_ & SCAN_PAIR) == SCAN_PAIR) computePair(row);
+    if (areaID) curr_.areaID = (*areaID)[i];
+    else if (needs_ & SCAN_AREA) computeArea(row);
+    for (ScanKernel *k : kernels_) k->visit(curr_);
+  }
+  end();
+}
@@ -0,0 +1,233 @@
+/**
+ * @file
+ * @brief Scoped stage timers and the profile of a run.
+ * @details
+ * Compiled in with -DSTAGE_PROFILE; otherwise the macros below expand to nothing and cost nothing.
+ * PROFILE_STAGE("name") times the rest of its scope as a stage, nested under the enclosing stage of the same thread,
+ * so the stages of a run form a tree. PROFILE_ROWS(n) and PROFILE_BYTES(n) add the rows processed and the bytes
+ * written to the innermost stage only: the rows and bytes of a stage do not include those of its children.
+ * Each thread records into its own tree without locking; PROFILE_REPORT merges the trees of all threads by path
+ * and prints the time, calls, rows and bytes of each stage. With several threads, the time of a stage is summed
+ * over the threads, so it can exceed the wall time of the run.
+ * The profile also shows the performance counters of each stage (see PerfCounters), counted on the thread
+ * of the stage; like the time, and unlike the rows and bytes, they include the children of the stage.
+ * Once PROFILE_TRACE_START has been called, the stage timers also record their begin and end events
+ * (see TraceRecorder), with the detail of PROFILE_STAGE_DETAIL (e.g. the data file of a user),
+ * and PROFILE_TRACE_WRITE dumps them as a Chrome trace.
+ * Built with -DALLOC_PROFILE, the stage timers also count the heap allocations of their stage (see alloc_counter.h),
+ * including its children like the time, and the profile shows them per stage and per thousand rows of the stage and its children.
+ */
+#if defined(ALLOC_PROFILE) && !defined(STAGE_PROFILE)
+#define STAGE_PROFILE
+#endif
+#ifdef STAGE_PROFILE
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include "trace_recorder.h"
+#ifdef ALLOC_PROFILE
+#include "alloc_counter.h"
+#endif
+
+struct StageNode {
+  const char *name;
+  StageNode *parent;
+  long calls;
+  long rows;
+  long bytes;
+  double seconds;
+  double counters[PERF_COUNTERS]; // -1 if not available
+  long allocations;               // heap allocations, in a build with -DALLOC_PROFILE
+  long allocatedBytes;
+  std::vector<std::unique_ptr<StageNode> > children;
+
+  StageNode(const char *n, StageNode *p) : name(n), parent(p), calls(0), rows(0), bytes(0), seconds(0),
+                                             allocations(0), allocatedBytes(0) {
+    for (int c = 0; c < PERF_COUNTERS; c++) counters[c] = 0;
+  };
+  void addCounters(const double *values) {
+    for (int c = 0; c < PERF_COUNTERS; c++) counters[c] = counters[c] < 0 || values[c] < 0 ? -1 : counters[c] + values[c];
+  };
+  // @returns the child stage named n, added if it is new
+  StageNode *child(const char *n) {
+    for (std::unique_ptr<StageNode> &c : children) {
+      if (c->name == n || strcmp(c->name, n) == 0) return c.get();
+    }
+    children.push_back(std::unique_ptr<StageNode>(new StageNode(n, this)));
+    return children.back().get();
+  };
+};
+
+class StageProfile {
+private:
+  static std::mutex &mutex() {
+    static std::mutex m;
+    return m;
+  };
+  // root of the tree of each thread, kept after the thread exits
+  static std::vector<std::unique_ptr<StageNode> > &roots() {
+    static std::vector<std::unique_ptr<StageNode> > r;
+    return r;
+  };
+  static void mergeInto(StageNode *to, const StageNode *from);
+  static void merged(StageNode &root);
+  static void addSeconds(const StageNode *node, std::string path, std::vector<std::pair<std::string, double> > &out);
+  static void print(std::ostream &out, const StageNode *node, int depth, double total);
+  static long totalRows(const StageNode *node);
+
+public:
+  // @returns the innermost stage of this thread
+  static StageNode *&current() {
+    static thread_local StageNode *node = nullptr;
+    if (!node) {
+      std::lock_guard<std::mutex> lock(mutex());
+      roots().push_back(std::unique_ptr<StageNode>(new StageNode("run", nullptr)));
+      node = roots().back().get();
+    }
+    return node;
+  };
+  // @returns the performance counters of this thread, opened on its first stage
+  static PerfCounters &perf() {
+    static thread_local PerfCounters p;
+    return p;
+  };
+  static void report(std::ostream &out);
+  static std::vector<std::pair<std::string, double> > seconds();
+};
+
+void StageProfile::mergeInto(StageNode *to, const StageNode *from) {
+  to->calls += from->calls;
+  to->rows += from->rows;
+  to->bytes += from->bytes;
+  to->seconds += from->seconds;
+  to->addCounters(from->counters);
+  to->allocations += from->allocations;
+  to->allocatedBytes += from->allocatedBytes;
+  for (const std::unique_ptr<StageNode> &c : from->children) mergeInto(to->child(c->name), c.get());
+}
+
+// merge the trees of all threads into root
+void StageProfile::merged(StageNode &root) {
+  std::lock_guard<std::mutex> lock(mutex());
+  for (std::unique_ptr<StageNode> &r : roots()) mergeInto(&root, r.get());
+}
+
+void StageProfile::addSeconds(const StageNode *node, std::string path, std::vector<std::pair<std::string, double> > &out) {
+  path += node->name;
+  out.push_back(std::make_pair(path, node->seconds));
+  for (const std::unique_ptr<StageNode> &c : node->children) addSeconds(c.get(), path + "/", out);
+}
+
+// @returns the seconds of each stage of all threads, named by its path (e.g. "user/readFile/sort")
+std::vector<std::pair<std::string, double> > StageProfile::seconds() {
+  StageNode root("run", nullptr);
+  merged(root);
+  std::vector<std::pair<std::string, double> > out;
+  for (std::unique_ptr<StageNode> &c : root.children) addSeconds(c.get(), "", out);
+  return out;
+}
+
+void StageProfile::print(std::ostream &out, const StageNode *node, int depth, double total) {
+  out << std::left << std::setw(40) << std::string(2 * depth, ' ') + node->name << std::right << std::fixed
+      << std::setprecision(3) << std::setw(10) << node->seconds << std::setprecision(1) << std::setw(7)
+      << (total > 0 ? 100 * node->seconds / total : 0) << "%" << std::setw(9) << node->calls << std::setw(12)
+      << node->rows << std::setw(12) << node->bytes;
+  const double *c = node->counters;
+  out << std::setw(7) << perfRatio(c[PERF_INSTRUCTIONS], c[PERF_CYCLES], 1)
+      << std::setw(9) << perfRatio(c[PERF_CACHE_MISSES], c[PERF_CACHE_REFERENCES], 100)
+      << std::setw(10) << perfRatio(c[PERF_BRANCH_MISSES], c[PERF_BRANCHES], 100)
+      << std::setw(10) << (c[PERF_PAGE_FAULTS] < 0 ? std::string("n/a") : std::to_string((long)c[PERF_PAGE_FAULTS]));
+#ifdef ALLOC_PROFILE
+  long rows = totalRows(node);
+  out << std::setw(11) << node->allocations << std::setw(14) << node->allocatedBytes << std::setw(12)
+      << (rows > 0 ? perfRatio(node->allocations, rows, 1000) : std::string("-"));
+#endif
+  out << std::endl;
+  out.unsetf(std::ios::fixed);
+  for (const std::unique_ptr<StageNode> &c : node->children) print(out, c.get(), depth + 1, total);
+}
+
+// @returns the rows of node and its children
+long StageProfile::totalRows(const StageNode *node) {
+  long rows = node->rows;
+  for (const std::unique_ptr<StageNode> &c : node->children) rows += totalRows(c.get());
+  return rows;
+}
+
+void StageProfile::report(std::ostream &out) {
+  StageNode root("run", nullptr);
+  merged(root);
+  double total = 0;
+  for (std::unique_ptr<StageNode> &c : root.children) total += c->seconds;
+  out << "\nStage profile:" << std::endl;
+  out << std::left << std::setw(40) << "stage" << std::right << std::setw(10) << "seconds" << std::setw(8) << "share"
+      << std::setw(9) << "calls" << std::setw(12) << "rows" << std::setw(12) << "bytes" << std::setw(7) << "IPC"
+      << std::setw(9) << "cache%" << std::setw(10) << "branch%" << std::setw(10) << "faults";
+#ifdef ALLOC_PROFILE
+  out << std::setw(11) << "allocs" << std::setw(14) << "alloc bytes" << std::setw(12) << "allocs/krow";
+#endif
+  out << std::endl;
+  for (std::unique_ptr<StageNode> &c : root.children) print(out, c.get(), 0, total);
+  if (!perf().error().empty()) out << "Some counters are not available (" << perf().error() << ")." << std::endl;
+}
+
+// times its scope as a child of the innermost stage of its thread
+class StageTimer {
+private:
+  StageNode *node_;
+  std::chrono::steady_clock::time_point start_;
+  double counters_[PERF_COUNTERS];
+#ifdef ALLOC_PROFILE
+  AllocCount allocs_;
+#endif
+
+public:
+  StageTimer(const char *name, const std::string *detail = nullptr) {
+    StageNode *&current = StageProfile::current();
+    node_ = current->child(name);
+    node_->calls++;
+    current = node_;
+    if (TraceRecorder::enabled()) TraceRecorder::record(name, 'B', detail);
+    StageProfile::perf().read(counters_);
+#ifdef ALLOC_PROFILE
+    allocs_ = threadAllocs();
+#endif
+    start_ = std::chrono::steady_clock::now();
+  };
+  ~StageTimer() {
+    node_->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    double end[PERF_COUNTERS];
+    StageProfile::perf().read(end);
+    for (int c = 0; c < PERF_COUNTERS; c++) end[c] = end[c] < 0 || counters_[c] < 0 ? -1 : end[c] - counters_[c];
+    node_->addCounters(end);
+#ifdef ALLOC_PROFILE
+    node_->allocations += threadAllocs().allocations - allocs_.allocations;
+    node_->allocatedBytes += threadAllocs().bytes - allocs_.bytes;
+#endif
+    if (TraceRecorder::enabled()) TraceRecorder::record(node_->name, 'E');
+    StageProfile::current() = node_->parent;
+  };
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_STAGE(name) StageTimer PROFILE_CONCAT(stageTimer, __LINE__)(name)
+#define PROFILE_STAGE_DETAIL(name, detail) StageTimer PROFILE_CONCAT(stageTimer, __LINE__)(name, &(detail))
+#define PROFILE_ROWS(n) (StageProfile::current()->rows += (n))
+#define PROFILE_BYTES(n) (StageProfile::current()->bytes += (n))
+#define PROFILE_REPORT(out) StageProfile::report(out)
+#define PROFILE_THREAD(name) TraceRecorder::nameThread(name)
+#define PROFILE_TRACE_START() TraceRecorder::start()
+#define PROFILE_TRACE_WRITE(filename) TraceRecorder::write(filename)
+#else
+#define PROFILE_STAGE(name)
+#define PROFILE_STAGE_DETAIL(name, detail)
+#define PROFILE_ROWS(n)
+#define PROFILE_BYTES(n)
+#define PROFILE_REPORT(out)
+#define PROFILE_THREAD(name)
+#define PROFILE_TRACE_START()
+#define PROFILE_TRACE_WRITE(filename) false
+#endif
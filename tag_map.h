@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @brief Open-addressing hash map from a cell tag to an int.
+ * @details
+ * The FlatTagMap keeps its entries in one array of slots, probed linearly from the hash of the tag.
+ * Each slot stores the hash of its tag, so a probe compares tags only when their hashes are equal,
+ * and growing the map does not hash the tags again. The load factor is kept at most 1/2, so a lookup
+ * usually takes one probe into one cache line. Slots are allocated from the current arena, in one block:
+ * inserting a tag allocates no node, and clear() keeps the slots for the next user.
+ */
+
+class FlatTagMap {
+public:
+  struct Slot {
+    ArenaString first;
+    int second;
+    size_t hash; // 0 for an empty slot
+  };
+  typedef std::vector<Slot, CellAllocator<Slot> > SLOTLIST;
+
+  // iterator over the occupied slots
+  class iterator {
+  private:
+    SLOTLIST *slots_;
+    size_t i_;
+
+  public:
+    iterator(SLOTLIST *slots, size_t i) : slots_(slots), i_(i) {
+      while (i_ < slots_->size() && (*slots_)[i_].hash == 0) i_++;
+    };
+    Slot &operator*() { return (*slots_)[i_]; };
+    Slot *operator->() { return &(*slots_)[i_]; };
+    iterator &operator++() {
+      for (i_++; i_ < slots_->size() && (*slots_)[i_].hash == 0; i_++) {}
+      return *this;
+    };
+    bool operator==(const iterator &other) const { return i_ == other.i_; };
+    bool operator!=(const iterator &other) const { return i_ != other.i_; };
+  };
+
+private:
+  SLOTLIST slots_;
+  size_t size_;
+  size_t mask_; // number of slots - 1, the number of slots being a power of two
+
+  static size_t hashOf(const char *s, size_t n) {
+    unsigned long long h = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < n; i++) {
+      h ^= (unsigned char)s[i];
+      h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+  };
+  // @returns the slot of key, or the empty slot where it would be inserted
+  size_t probe(const char *key, size_t n, size_t hash) {
+    size_t i = hash & mask_;
+    while (slots_[i].hash != 0) {
+      if (slots_[i].hash == hash && slots_[i].first.size() == n && slots_[i].first.compare(0, n, key, n) == 0) break;
+      i = (i + 1) & mask_;
+    }
+    return i;
+  };
+  void rehash(size_t numSlots);
+
+public:
+  FlatTagMap() : size_(0), mask_(0) {};
+  iterator begin() { return iterator(&slots_, 0); };
+  iterator end() { return iterator(&slots_, slots_.size()); };
+  size_t size() { return size_; };
+  void reserve(size_t n);
+  void clear();
+  iterator find(const ArenaString &key);
+  size_t count(const ArenaString &key) { return find(key) != end() ? 1 : 0; };
+  int &operator[](const ArenaString &key);
+};
+
+void FlatTagMap::rehash(size_t numSlots) {
+  SLOTLIST old;
+  old.swap(slots_);
+  slots_.resize(numSlots);
+  mask_ = numSlots - 1;
+  for (Slot &s : old) {
+    if (s.hash == 0) continue;
+    size_t i = s.hash & mask_;
+    while (slots_[i].hash != 0) i = (i + 1) & mask_;
+    slots_[i].first.swap(s.first);
+    slots_[i].second = s.second;
+    slots_[i].hash = s.hash;
+  }
+}
+
+// make room for n tags without growing
+void FlatTagMap::reserve(size_t n) {
+  size_t numSlots = 16;
+  while (numSlots < 2 * n) numSlots *= 2;
+  if (numSlots > slots_.size()) rehash(numSlots);
+}
+
+// remove every tag, keeping the slots
+void FlatTagMap::clear() {
+  for (Slot &s : slots_) {
+    s.first.clear();
+    s.hash = 0;
+  }
+  size_ = 0;
+}
+
+FlatTagMap::iterator FlatTagMap::find(const ArenaString &key) {
+  if (size_ == 0) return end();
+  size_t i = probe(key.data(), key.size(), hashOf(key.data(), key.size()));
+  return iterator(&slots_, slots_[i].hash != 0 ? i : slots_.size());
+}
+
+int &FlatTagMap::operator[](const ArenaString &key) {
+  if (2 * (size_ + 1) > slots_.size()) reserve(size_ + 1 > 8 ? 2 * (size_ + 1) : 8);
+  size_t hash = hashOf(key.data(), key.size());
+  size_t i = probe(key.data(), key.size(), hash);
+  if (slots_[i].hash == 0) {
+    slots_[i].first.assign(key.data(), key.size());
+    slots_[i].second = 0;
+    slots_[i].hash = hash;
+    size_++;
+  }
+  return slots_[i].second;
+}
+
+// map from a tag to an index
+typedef FlatTagMap TAGMAP;
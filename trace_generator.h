@@ -0,0 +1,308 @@
+/**
+ * @file
+ * @brief Deterministic generator of synthetic mobility traces.
+ * @details
+ * The TraceGenerator writes data files in the format of data.csv (time, lon, lat and tag, separated by tabs),
+ * one file per user, together with the ground truth of each user (home, work and the cells serving them).
+ * 1. Towers are laid out over a square city as a grid, uniformly at random, or in clusters around a few centres.
+ * 2. Each user has a home and a workplace. On weekdays, the user leaves home in the morning, travels to work
+ *    at the trip speed, travels back in the evening and sometimes runs an errand; on weekends, the user stays
+ *    home apart from an errand.
+ * 3. The phone logs a row at exponentially distributed intervals. Its row is served by the nearest tower, or by
+ *    the second nearest one when the two are about as close (handover ping-pong), and its position is the true
+ *    position blurred by gaussian noise.
+ * Every random draw comes from a generator seeded by the seed and the user index, so a user's file only depends
+ * on the configuration and its index, whatever the number of users or the order they are written in.
+ */
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+enum TowerLayout {
+  LAYOUT_GRID,
+  LAYOUT_RANDOM,
+  LAYOUT_CLUSTERED
+};
+
+struct TraceConfig {
+  int users;
+  int days;
+  std::string startDate;  // YYYY-MM-DD of the first day
+  int towers;
+  TowerLayout layout;
+  double cityKm;          // width of the city
+  double pingInterval;    // mean seconds between rows
+  double tripSpeed;       // km per hour
+  double pingPong;        // probability of a handover to the second nearest tower when both are about as close
+  double noiseMeters;     // standard deviation of the position noise
+  unsigned long long seed;
+
+  // @returns the defaults of the generator, to be overridden field by field
+  static TraceConfig defaults() {
+    TraceConfig config;
+    config.users = 1;
+    config.days = 1;
+    config.startDate = "2017-11-23";
+    config.towers = 400;
+    config.layout = LAYOUT_GRID;
+    config.cityKm = 20;
+    config.pingInterval = 30;
+    config.tripSpeed = 30;
+    config.pingPong = 0.2;
+    config.noiseMeters = 50;
+    config.seed = 1;
+    return config;
+  };
+};
+
+struct Place {
+  double lon;
+  double lat;
+};
+
+// ground truth of a user
+struct TraceTruth {
+  Place home;
+  Place work;
+  int homeTower;
+  int workTower;
+  long rows;
+};
+
+class TraceRandom {
+private:
+  unsigned long long state_;
+
+public:
+  // splitmix64 of seed and stream, so every stream starts from a well mixed state
+  TraceRandom(unsigned long long seed, unsigned long long stream) {
+    unsigned long long z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    state_ = (z ^ (z >> 31)) | 1;
+  };
+  unsigned long long next() { // xorshift64*
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ULL;
+  };
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }; // [0, 1)
+  double gaussian() {
+    double u = uniform(), v = uniform();
+    return sqrt(-2 * log(u + 1e-300)) * cos(2 * M_PI * v);
+  };
+  double exponential(double mean) { return -mean * log(1 - uniform()); };
+};
+
+class TraceGenerator {
+private:
+  // a leg of the day: at place from at t0, at place to at t1, moving linearly in between
+  struct Leg {
+    double t0, t1;
+    Place from, to;
+  };
+
+  TraceConfig config_;
+  std::vector<Place> towers_;
+  // towers bucketed on a grid of bucketKm_ squares, to find the nearest towers of a position
+  std::vector<std::vector<int> > buckets_;
+  int bucketsPerSide_;
+  double bucketKm_;
+  Place origin_;     // south-west corner of the city
+  double kmPerLon_, kmPerLat_;
+  time_t startTime_; // 00:00:00 of the first day, as UTC seconds
+
+  Place placeAt(double xKm, double yKm) {
+    Place p = {origin_.lon + xKm / kmPerLon_, origin_.lat + yKm / kmPerLat_};
+    return p;
+  };
+  void layTowers();
+  void nearestTowers(const Place &p, int &first, int &second, double &d1, double &d2);
+  Place randomPlace(TraceRandom &rng) { return placeAt(rng.uniform() * config_.cityKm, rng.uniform() * config_.cityKm); };
+  void planDay(int day, const Place &home, const Place &work, TraceRandom &rng, std::vector<Leg> &legs);
+
+public:
+  TraceGenerator(const TraceConfig &config);
+  const std::vector<Place> &towers() { return towers_; };
+  TraceTruth writeUser(int user, std::string filename);
+};
+
+TraceGenerator::TraceGenerator(const TraceConfig &config) : config_(config) {
+  origin_.lon = 121.52 - 0.5 * config_.cityKm / (111.32 * cos(25.05 * M_PI / 180));
+  origin_.lat = 25.05 - 0.5 * config_.cityKm / 110.57;
+  kmPerLon_ = 111.32 * cos(25.05 * M_PI / 180);
+  kmPerLat_ = 110.57;
+
+  tm t = {};
+  if (!strptime(config_.startDate.c_str(), "%Y-%m-%d", &t)) {
+    std::cout << "ERROR: Invalid start date " << config_.startDate << "." << std::endl;
+    exit(0);
+  }
+  startTime_ = timegm(&t);
+  layTowers();
+}
+
+void TraceGenerator::layTowers() {
+  TraceRandom rng(config_.seed, 0xFFFFFFFFULL); // the stream of the layout, distinct from the users'
+  double w = config_.cityKm;
+  int n = config_.towers;
+  if (config_.layout == LAYOUT_GRID) {
+    int side = (int)ceil(sqrt((double)n));
+    for (int i = 0; i < n; i++)
+      towers_.push_back(placeAt((i % side + 0.5) * w / side, (i / side + 0.5) * w / side));
+  } else if (config_.layout == LAYOUT_RANDOM) {
+    for (int i = 0; i < n; i++) towers_.push_back(randomPlace(rng));
+  } else { // a few dense centres, as downtowns with more towers than the suburbs
+    int centres = 1 + n / 100;
+    std::vector<Place> centre;
+    for (int c = 0; c < centres; c++) centre.push_back(randomPlace(rng));
+    for (int i = 0; i < n; i++) {
+      Place c = centre[i % centres];
+      double x = (c.lon - origin_.lon) * kmPerLon_ + rng.gaussian() * w / 8;
+      double y = (c.lat - origin_.lat) * kmPerLat_ + rng.gaussian() * w / 8;
+      towers_.push_back(placeAt(fmin(fmax(x, 0), w), fmin(fmax(y, 0), w)));
+    }
+  }
+
+  bucketsPerSide_ = (int)ceil(sqrt((double)n / 2));
+  bucketKm_ = w / bucketsPerSide_;
+  buckets_.assign(bucketsPerSide_ * bucketsPerSide_, std::vector<int>());
+  for (int i = 0; i < n; i++) {
+    int bx = (int)fmin((towers_[i].lon - origin_.lon) * kmPerLon_ / bucketKm_, bucketsPerSide_ - 1);
+    int by = (int)fmin((towers_[i].lat - origin_.lat) * kmPerLat_ / bucketKm_, bucketsPerSide_ - 1);
+    buckets_[by * bucketsPerSide_ + bx].push_back(i);
+  }
+}
+
+/**
+ * Find the nearest and second nearest towers of p, and their distances in km.
+ * Rings of buckets are searched outwards until no unsearched bucket can hold a tower nearer than the second.
+ */
+void TraceGenerator::nearestTowers(const Place &p, int &first, int &second, double &d1, double &d2) {
+  double x = (p.lon - origin_.lon) * kmPerLon_, y = (p.lat - origin_.lat) * kmPerLat_;
+  int bx = (int)fmin(fmax(x / bucketKm_, 0), bucketsPerSide_ - 1);
+  int by = (int)fmin(fmax(y / bucketKm_, 0), bucketsPerSide_ - 1);
+  first = second = -1;
+  d1 = d2 = INFINITY;
+  for (int r = 0; r < bucketsPerSide_; r++) {
+    if (second >= 0 && (r - 1) * bucketKm_ > d2) break;
+    for (int j = by - r; j <= by + r; j++) {
+      for (int i = bx - r; i <= bx + r; i++) {
+        if (i < 0 || j < 0 || i >= bucketsPerSide_ || j >= bucketsPerSide_) continue;
+        if (abs(i - bx) != r && abs(j - by) != r) continue; // only the ring r
+        for (int t : buckets_[j * bucketsPerSide_ + i]) {
+          double dx = (towers_[t].lon - p.lon) * kmPerLon_, dy = (towers_[t].lat - p.lat) * kmPerLat_;
+          double d = sqrt(dx * dx + dy * dy);
+          if (d < d1) {
+            second = first;
+            d2 = d1;
+            first = t;
+            d1 = d;
+          } else if (d < d2) {
+            second = t;
+            d2 = d;
+          }
+        }
+      }
+    }
+  }
+}
+
+// the legs of day: a weekday commute with an optional errand, or a weekend errand
+void TraceGenerator::planDay(int day, const Place &home, const Place &work, TraceRandom &rng, std::vector<Leg> &legs) {
+  double dayStart = startTime_ + day * 86400.0;
+  double t = dayStart;
+  Place at = home;
+  tm date = {};
+  time_t seconds = (time_t)dayStart;
+  gmtime_r(&seconds, &date);
+  bool weekday = date.tm_wday >= 1 && date.tm_wday <= 5;
+  legs.clear();
+
+  // stay at the current place until leave, then travel to p at the trip speed
+  auto travel = [&](double leave, const Place &p) {
+    double dx = (p.lon - at.lon) * kmPerLon_, dy = (p.lat - at.lat) * kmPerLat_;
+    double hours = sqrt(dx * dx + dy * dy) / config_.tripSpeed;
+    leave = fmax(leave, t);
+    Leg stay = {t, leave, at, at};
+    Leg trip = {leave, leave + hours * 3600, at, p};
+    legs.push_back(stay);
+    legs.push_back(trip);
+    t = trip.t1;
+    at = p;
+  };
+
+  if (weekday) {
+    travel(dayStart + 8 * 3600 + rng.gaussian() * 1800, work);
+    travel(dayStart + 17.5 * 3600 + rng.gaussian() * 2700, home);
+  }
+  if (rng.uniform() < (weekday ? 0.3 : 0.8)) {
+    Place errand = randomPlace(rng);
+    double leave = dayStart + (weekday ? 19.5 : 13) * 3600 + rng.gaussian() * 1800;
+    if (leave > t) {
+      travel(leave, errand);
+      travel(t + 3600 + rng.exponential(1800), home);
+    }
+  }
+  Leg rest = {t, fmax(dayStart + 86400, t), at, at};
+  legs.push_back(rest);
+}
+
+/**
+ * Write the rows of the user-th user to filename, in the order of time.
+ * @returns the ground truth of the user.
+ */
+TraceTruth TraceGenerator::writeUser(int user, std::string filename) {
+  TraceRandom rng(config_.seed, user);
+  TraceTruth truth;
+  truth.home = randomPlace(rng);
+  truth.work = randomPlace(rng);
+  int second;
+  double d1, d2;
+  nearestTowers(truth.home, truth.homeTower, second, d1, d2);
+  nearestTowers(truth.work, truth.workTower, second, d1, d2);
+  truth.rows = 0;
+
+  FILE *file = fopen(filename.c_str(), "w");
+  if (!file) {
+    std::cout << "ERROR: The file " << filename << " cannot be created." << std::endl;
+    exit(0);
+  }
+  std::vector<char> buffer(1 << 16);
+  setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+  fprintf(file, "DATE_TIME\tLON\tLAT\tTAG\n");
+
+  std::vector<Leg> legs;
+  double t = startTime_ + rng.exponential(config_.pingInterval);
+  double degPerMeterLat = 1 / (kmPerLat_ * 1000), degPerMeterLon = 1 / (kmPerLon_ * 1000);
+  char datetime[32];
+  for (int day = 0; day < config_.days; day++) {
+    planDay(day, truth.home, truth.work, rng, legs);
+    int leg = 0;
+    double dayEnd = startTime_ + (day + 1) * 86400.0;
+    for (; t < dayEnd; t += fmax(1, rng.exponential(config_.pingInterval))) {
+      while (leg + 1 < legs.size() && legs[leg].t1 <= t) leg++;
+      const Leg &l = legs[leg];
+      double f = l.t1 > l.t0 ? fmin(fmax((t - l.t0) / (l.t1 - l.t0), 0), 1) : 1;
+      Place p = {l.from.lon + f * (l.to.lon - l.from.lon), l.from.lat + f * (l.to.lat - l.from.lat)};
+
+      int tower;
+      nearestTowers(p, tower, second, d1, d2);
+      if (second >= 0 && d2 < 1.3 * d1 && rng.uniform() < config_.pingPong) tower = second;
+
+      time_t seconds = (time_t)t;
+      tm date;
+      gmtime_r(&seconds, &date);
+      strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", &date);
+      fprintf(file, "%s\t%.6f\t%.6f\tCELL_%d\n", datetime,
+              p.lon + rng.gaussian() * config_.noiseMeters * degPerMeterLon,
+              p.lat + rng.gaussian() * config_.noiseMeters * degPerMeterLat, tower);
+      truth.rows++;
+    }
+  }
+  fclose(file);
+  return truth;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file
+ * @brief Recorder of the begin and end events of the stages, in the Chrome trace-event format.
+ * @details
+ * Part of the stage profile (-DSTAGE_PROFILE), and switched on at run time by TraceRecorder::start.
+ * Each thread appends its events to its own TraceBuffer; the buffers are linked into a list by an atomic
+ * compare-and-swap when a thread records its first event, so recording never takes a lock.
+ * TraceRecorder::write dumps the events of all threads as a json file for chrome://tracing or Perfetto,
+ * one track per thread, named by TraceRecorder::nameThread (e.g. "worker 2").
+ * The buffers are only read by write, which must be called once the threads have stopped recording.
+ */
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+  const char *name;
+  char phase;     // 'B' for the beginning of a stage, 'E' for its end
+  long long ns;   // since the start of the recording
+  int detail;     // index in the details of the buffer, -1 if none
+};
+
+struct TraceBuffer {
+  int tid;
+  std::string threadName;
+  std::vector<TraceEvent> events;
+  std::vector<std::string> details;
+  TraceBuffer *next;
+};
+
+class TraceRecorder {
+private:
+  static std::atomic<bool> &enabled_() {
+    static std::atomic<bool> e(false);
+    return e;
+  };
+  static std::atomic<TraceBuffer *> &head() {
+    static std::atomic<TraceBuffer *> h(nullptr);
+    return h;
+  };
+  static std::chrono::steady_clock::time_point &origin() {
+    static std::chrono::steady_clock::time_point o;
+    return o;
+  };
+  // @returns the buffer of this thread, linked into the list of buffers on first use
+  static TraceBuffer &buffer() {
+    static std::atomic<int> nextTid(1);
+    static thread_local TraceBuffer *b = nullptr;
+    if (!b) {
+      b = new TraceBuffer(); // kept after the thread exits, until the trace is written
+      b->tid = nextTid++;
+      b->events.reserve(4096);
+      b->next = head().load();
+      while (!head().compare_exchange_weak(b->next, b)) {}
+    }
+    return *b;
+  };
+
+public:
+  static bool enabled() { return enabled_().load(std::memory_order_relaxed); };
+  static void start() {
+    origin() = std::chrono::steady_clock::now();
+    enabled_() = true;
+  };
+  static void nameThread(const std::string &name) {
+    if (enabled()) buffer().threadName = name;
+  };
+  static void record(const char *name, char phase, const std::string *detail = nullptr) {
+    TraceBuffer &b = buffer();
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin()).count();
+    int d = -1;
+    if (detail) {
+      d = b.details.size();
+      b.details.push_back(*detail);
+    }
+    b.events.push_back({name, phase, ns, d});
+  };
+  static bool write(const std::string &filename);
+};
+
+// @returns s as a json string
+std::string traceString(const std::string &s) {
+  std::string quoted = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') quoted += '\\';
+    if ((unsigned char)c < 0x20) quoted += ' ';
+    else quoted += c;
+  }
+  return quoted + "\"";
+}
+
+// write the events of every thread, in the json object format of the Chrome trace events
+bool TraceRecorder::write(const std::string &filename) {
+  std::ofstream ofs(filename);
+  if (!ofs) return false;
+  ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+  bool first = true;
+  for (TraceBuffer *b = head().load(); b; b = b->next) {
+    std::string threadName = b->threadName.empty() ? "thread " + std::to_string(b->tid) : b->threadName;
+    ofs << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+        << ", \"args\": {\"name\": " << traceString(threadName) << "}}";
+    first = false;
+    for (TraceEvent &e : b->events) {
+      ofs << ",\n{\"name\": " << traceString(e.name) << ", \"ph\": \"" << e.phase << "\", \"pid\": 1, \"tid\": " << b->tid
+          << ", \"ts\": " << e.ns / 1000 << "." << std::to_string(1000 + e.ns % 1000).substr(1);
+      if (e.detail >= 0) ofs << ", \"args\": {\"detail\": " << traceString(b->details[e.detail]) << "}";
+      ofs << "}";
+    }
+  }
+  ofs << "\n]}" << std::endl;
+  return true;
+}
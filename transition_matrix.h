@@ -0,0 +1,185 @@
+/**
+ * @file
+ * @brief Sparse matrices of the transitions between cells, per user and over the whole population.
+ * @details
+ * A transition is a pair of consecutive rows (in the order of time) on different cells. Its dwell time is
+ * the time from the first row of the run of rows on the source cell to the first row on the destination cell,
+ * so that weighting the transitions by their dwell time favours the cells where the user stays.
+ * The TransitionKernel counts the transitions of a user in one scan of its rows, so it also runs out of core.
+ * A TransitionCounter accumulates transitions by cell tag in a hash map; each worker of a batch keeps its own,
+ * adding the matrices of its users, and the counters of the workers are merged once the batch is done.
+ * TransitionMatrix is the compressed sparse row (CSR) form of a counter: the transitions from each cell are
+ * stored contiguously, sorted by their destination, and the cells are sorted by tag, so matrices of different
+ * users and runs index the same tags in the same order.
+ */
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+class TransitionMatrix {
+private:
+  std::vector<std::string> cells_; // tag of each row and column
+  std::vector<long> rowStart_;     // the transitions from cell i are [rowStart_[i], rowStart_[i + 1])
+  std::vector<int> to_;
+  std::vector<long> counts_;
+  std::vector<double> dwell_;      // seconds spent in the source cell before the transitions
+
+  friend class TransitionCounter;
+
+public:
+  TransitionMatrix() : rowStart_(1, 0) {};
+  int numCells() const { return cells_.size(); };
+  long numEdges() const { return to_.size(); };
+  const std::string &cell(int i) const { return cells_[i]; };
+  // @returns the index of the cell tagged tag, or -1
+  int find(const std::string &tag) const {
+    std::vector<std::string>::const_iterator it = std::lower_bound(cells_.begin(), cells_.end(), tag);
+    return it != cells_.end() && *it == tag ? (int)(it - cells_.begin()) : -1;
+  };
+  long begin(int from) const { return rowStart_[from]; };
+  long end(int from) const { return rowStart_[from + 1]; };
+  int to(long edge) const { return to_[edge]; };
+  long count(long edge) const { return counts_[edge]; };
+  double dwell(long edge) const { return dwell_[edge]; };
+  // @returns the edge from cell from to cell to, or -1
+  long edge(int from, int to) const {
+    std::vector<int>::const_iterator first = to_.begin() + rowStart_[from], last = to_.begin() + rowStart_[from + 1];
+    std::vector<int>::const_iterator it = std::lower_bound(first, last, to);
+    return it != last && *it == to ? it - to_.begin() : -1;
+  };
+  double probability(int from, int to, bool dwellWeighted) const;
+  bool write(std::string filename) const;
+};
+
+/**
+ * @returns the probability of moving from cell from to cell to, among the transitions from cell from,
+ * weighted by the number of transitions or, if dwellWeighted, by their dwell time
+ */
+double TransitionMatrix::probability(int from, int to, bool dwellWeighted) const {
+  long e = edge(from, to);
+  if (e < 0) return 0;
+  double total = 0;
+  for (long i = rowStart_[from]; i < rowStart_[from + 1]; i++) total += dwellWeighted ? dwell_[i] : counts_[i];
+  return total > 0 ? (dwellWeighted ? dwell_[e] : counts_[e]) / total : 0;
+}
+
+// write the transitions as a csv file, one row per pair of cells
+bool TransitionMatrix::write(std::string filename) const {
+  std::ofstream ofs(filename);
+  ofs << "from,to,count,dwell_seconds" << std::endl;
+  for (int i = 0; i < cells_.size(); i++) {
+    for (long e = rowStart_[i]; e < rowStart_[i + 1]; e++)
+      ofs << cells_[i] << "," << cells_[to_[e]] << "," << counts_[e] << "," << dwell_[e] << "\n";
+  }
+  countBytesWritten(ofs.tellp());
+  ofs.close();
+  return (bool)ofs;
+}
+
+class TransitionCounter {
+private:
+  struct Edge {
+    long count;
+    double dwell;
+  };
+  std::unordered_map<std::string, int> ids_;
+  std::vector<std::string> cells_;
+  std::unordered_map<unsigned long long, Edge> edges_; // by source << 32 | destination
+
+public:
+  // @returns the index of the cell tagged tag in this counter, added if it is new
+  int id(const std::string &tag) {
+    std::pair<std::unordered_map<std::string, int>::iterator, bool> it = ids_.insert(std::make_pair(tag, (int)cells_.size()));
+    if (it.second) cells_.push_back(tag);
+    return it.first->second;
+  };
+  void add(int from, int to, long count, double dwell) {
+    Edge &e = edges_[(unsigned long long)from << 32 | (unsigned)to];
+    e.count += count;
+    e.dwell += dwell;
+  };
+  void add(const TransitionMatrix &m);
+  void add(const TransitionCounter &other);
+  bool empty() { return edges_.empty(); };
+  TransitionMatrix matrix();
+};
+
+void TransitionCounter::add(const TransitionMatrix &m) {
+  std::vector<int> ids(m.numCells());
+  for (int i = 0; i < m.numCells(); i++) ids[i] = id(m.cell(i));
+  for (int i = 0; i < m.numCells(); i++) {
+    for (long e = m.begin(i); e < m.end(i); e++) add(ids[i], ids[m.to(e)], m.count(e), m.dwell(e));
+  }
+}
+
+void TransitionCounter::add(const TransitionCounter &other) {
+  std::vector<int> ids(other.cells_.size());
+  for (int i = 0; i < other.cells_.size(); i++) ids[i] = id(other.cells_[i]);
+  for (const std::pair<const unsigned long long, Edge> &e : other.edges_)
+    add(ids[e.first >> 32], ids[e.first & 0xffffffffULL], e.second.count, e.second.dwell);
+}
+
+// @returns the transitions counted so far as a matrix whose cells are sorted by tag
+TransitionMatrix TransitionCounter::matrix() {
+  TransitionMatrix m;
+  std::vector<int> order(cells_.size()), rank(cells_.size());
+  for (int i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [this](int a, int b) { return cells_[a] < cells_[b]; });
+  for (int r = 0; r < order.size(); r++) {
+    rank[order[r]] = r;
+    m.cells_.push_back(cells_[order[r]]);
+  }
+
+  std::vector<std::pair<unsigned long long, Edge> > sorted;
+  sorted.reserve(edges_.size());
+  for (std::pair<const unsigned long long, Edge> &e : edges_)
+    sorted.push_back(std::make_pair((unsigned long long)rank[e.first >> 32] << 32 | rank[e.first & 0xffffffffULL], e.second));
+  std::sort(sorted.begin(), sorted.end(), [](const std::pair<unsigned long long, Edge> &a,
+                                             const std::pair<unsigned long long, Edge> &b) { return a.first < b.first; });
+  m.rowStart_.assign(cells_.size() + 1, 0);
+  m.to_.reserve(sorted.size());
+  m.counts_.reserve(sorted.size());
+  m.dwell_.reserve(sorted.size());
+  for (std::pair<unsigned long long, Edge> &e : sorted) {
+    m.rowStart_[(e.first >> 32) + 1]++;
+    m.to_.push_back(e.first & 0xffffffffULL);
+    m.counts_.push_back(e.second.count);
+    m.dwell_.push_back(e.second.dwell);
+  }
+  for (int i = 0; i < cells_.size(); i++) m.rowStart_[i + 1] += m.rowStart_[i];
+  return m;
+}
+
+// counts the transitions of a user: transitions.csv
+class TransitionKernel : public ScanKernel {
+private:
+  std::string prefix_;
+  TransitionCounter counter_;
+  TransitionMatrix matrix_;
+  std::string prevTag_;
+  int prev_;
+  time_t enter_; // time of the first row of the run on the current cell
+
+public:
+  TransitionKernel(std::string prefix) : prefix_(prefix) {};
+  int needs() { return SCAN_TIME; };
+  void begin() {
+    counter_ = TransitionCounter();
+    prev_ = -1;
+  };
+  void visit(const ScanRow &r) {
+    const ArenaString &tag = r.row->getTag();
+    if (prev_ >= 0 && prevTag_.compare(0, prevTag_.size(), tag.data(), tag.size()) == 0) return;
+    prevTag_.assign(tag.data(), tag.size());
+    int id = counter_.id(prevTag_);
+    if (prev_ >= 0) counter_.add(prev_, id, 1, difftime(r.time, enter_));
+    prev_ = id;
+    enter_ = r.time;
+  };
+  void end() {
+    PROFILE_STAGE("transitions");
+    matrix_ = counter_.matrix();
+    matrix_.write(prefix_ + "transitions.csv");
+  };
+  const TransitionMatrix &matrix() { return matrix_; };
+};
@@ -11,12 +11,47 @@
  * 3. findResidentialAreaByTopKCells: Find residential areas by finding cells with the top k largest numConnections.
  * 
  * 4. findResidentialAreaBySpeed: Output json files of possible residential areas by user movement detection.
+ *
+ * 5. analyse: Produce the selected outputs of the above analyses, running only the stages they need.
+ *
+ * In the approximate mode, a User holds a time-stratified sample of its data logs (see StratifiedReservoir),
+ * and reportSampleError estimates the error of the results.
+ * In the progressive mode, a ProgressiveAnalysis publishes early estimates while the data logs are read.
+ * In the out-of-core mode, no User is built: an ExternalSorter streams the sorted data logs into the scan kernels below.
  */
 
 #include "cell.h"
+#include "analysis_graph.h"
+#include "scan_engine.h"
+#include "sampling.h"
+#include "progressive.h"
+#include "ingest_estimate.h"
+#include "external_sort.h"
+#include "transition_matrix.h"
+#include "next_location.h"
+#include "colocation.h"
 #include <queue>
 
-typedef std::pair<std::string, int> PAIR;
+typedef std::pair<ArenaString, int> PAIR;
+
+enum Output {
+  OUTPUT_AREA = 1,     // time-vs-area.csv
+  OUTPUT_MIDPOINT = 2, // midpoint of each area and the differences from it, printed to the log
+  OUTPUT_CDF = 4,      // {gravity,average}-area-*.csv
+  OUTPUT_GEO = 8,      // area-*-{lon,lat}.txt
+  OUTPUT_SPEED = 16,   // time-vs-speed.csv
+  OUTPUT_MAP = 32,     // map-by-speed-*.json
+  OUTPUT_TRANSITIONS = 256, // transitions.csv, and population-transitions.csv over the batch
+  OUTPUT_PREDICTION = 512,  // next-location.json, and the predicted next areas printed to the log
+  OUTPUT_COLOCATION = 1024  // colocation.csv over the batch
+};
+
+// outputs of each analysis
+enum Analysis {
+  ANALYSIS_TOPK_CELLS = OUTPUT_AREA | OUTPUT_MIDPOINT | OUTPUT_CDF | OUTPUT_GEO, // findResidentialAreaByTopKCells
+  ANALYSIS_SPEED_SERIES = OUTPUT_SPEED,                                         // calculateSpeedOfEachTime
+  ANALYSIS_BY_SPEED = OUTPUT_MAP                                                // findResidentialAreaBySpeed
+};
 
 struct compareBySecondValue {
   bool operator()(const PAIR & a, const PAIR & b) {
@@ -26,29 +61,80 @@ struct compareBySecondValue {
 
 class User {
 private:
-  std::vector<DataRow> rowList_;
-  std::unordered_map<std::string, int> cellMap_; // map cell tag to its index in cellList_
-  std::vector<Cell> cellList_;
+  ROWLIST rowList_;
+  TAGMAP cellMap_; // map cell tag to its index in cellList_
+  std::vector<Cell, CellAllocator<Cell> > cellList_;
 
   // used for finding cells with top k largest numConnections
-  std::priority_queue<PAIR, std::vector<PAIR>, compareBySecondValue> cellQueue_;
+  std::priority_queue<PAIR, std::vector<PAIR, CellAllocator<PAIR> >, compareBySecondValue> cellQueue_;
+
+  // derived columns shared by the analyses below
+  AnalysisGraph graph_;
+  TAGMAP areaMap_; // map cell tag to its areaID
+  std::vector<int, CellAllocator<int> > cellArea_; // areaID of each cell in cellList_, the dense copy of areaMap_
+  int areaCount_;
+  int labelledInterval_; // interval used for areaMap_, 0 if areas have not been labelled
+  int areaOf(DataRow &r) { return cellArea_[r.getCellID()]; };
+  void outputMidpoints(int areaCount, int outputs);
+
+  TransitionMatrix transitions_; // set by analyse if OUTPUT_TRANSITIONS is selected
+  ColocationJoin *colocation_;   // receives the visits of the user if OUTPUT_COLOCATION is selected
+  int userID_;                   // of the user in colocation_
+
+  std::string outputPrefix_; // prepended to the name of every output file
+  std::ostream *log_;
+
+  std::unique_ptr<StratifiedReservoir> sample_; // set in the approximate mode
+  ProgressiveAnalysis *progress_;               // set in the progressive mode
+
+  // used for pre-sizing rowList_ and cellList_
+  IngestEstimate estimate_;
+  std::vector<int, CellAllocator<int> > cellRows_; // number of rows of each cell in cellList_
+  int reallocations_;                                // number of times rowList_ or cellList_ grew while reading
+  void presize(long rows, long cells);
+  void addRow(DataRow d);
+  void finishReading();
 
 public:
-  User(std::string filename) { readFile(filename); };
+  User(std::string filename) : graph_(rowList_), areaCount_(0), labelledInterval_(0), colocation_(nullptr), userID_(0),
+                               log_(&std::cout), progress_(nullptr), reallocations_(0) {
+    readFile(filename);
+  };
+  // approximate mode: keep up to sampleCapacity rows of each hour of data
+  // progressive mode: publish early estimates to progress while reading
+  User(std::string filename, int sampleCapacity, ProgressiveAnalysis *progress = nullptr) :
+    graph_(rowList_), areaCount_(0), labelledInterval_(0), colocation_(nullptr), userID_(0), log_(&std::cout),
+    progress_(progress), reallocations_(0) {
+    if (sampleCapacity > 0) readSample(filename, sampleCapacity);
+    else readFile(filename);
+  };
   void readFile(std::string filename);
+  void readSample(std::string filename, int sampleCapacity);
+  void reportSampleError();
+  void reportStats();
+  void setOutputPrefix(std::string prefix) { outputPrefix_ = prefix; };
+  void setLog(std::ostream &log) { log_ = &log; };
+  void setColocation(ColocationJoin *join, int userID) {
+    colocation_ = join;
+    userID_ = userID;
+  };
+  int labelAreasByTopKCells(int interval);
   void findResidentialAreaByTopKCells(int interval);
   void findResidentialAreaBySpeed();
   void calculateSpeedOfEachTime();
+  void analyse(int interval, int outputs);
+  const TransitionMatrix &transitions() { return transitions_; };
   int numConnections(std::string cell) {
     isValid(cell);
-    return cellList_[cellMap_[cell]].numConnections();
+    return cellList_[cellMap_[ArenaString(cell.data(), cell.size())]].numConnections();
   };
-  std::vector<TIMEPAIR> getTimeSegments(std::string cell, int interval) {
+  SEGMENTLIST getTimeSegments(std::string cell, int interval) {
     isValid(cell);
-    return cellList_[cellMap_[cell]].getTimeSegments(interval);
+    return cellList_[cellMap_[ArenaString(cell.data(), cell.size())]].getTimeSegments(interval);
   };
+  bool hasCell(std::string cell) { return cellMap_.count(ArenaString(cell.data(), cell.size())) > 0; };
   void isValid(std::string cell) { 
-    if(cellMap_.count(cell) == 0) {
+    if(!hasCell(cell)) {
       std::cout << "ERROR: This cell does not exist." << std::endl;
       exit(0);
     } 
@@ -56,37 +142,183 @@ public:
 };
 
 void User::readFile(std::string filename) {
+  PROFILE_STAGE("readFile");
   std::ifstream dataSource(filename);
   if (!dataSource) {
     std::cout << "ERROR: The file cannot be opened." << std::endl;
     exit(0);
   }
 
+  estimate_ = estimateIngest(filename);
+  presize(estimate_.rows + estimate_.rows / 20 + 16, estimate_.cells); // 5% margin over the estimated rows
+  if (progress_) progress_->start(filename);
+  {
+    PROFILE_STAGE("parse");
+    CSVRow row;
+    dataSource >> row; // skip the first line
+    while (dataSource >> row) {
+      tm tm = {};
+      parseDateTime(row[0], tm);
+      addRow(DataRow(tm, stod(row[1]), stod(row[2]), row[3]));
+      if (progress_ && progress_->add(rowList_.back())) progress_->publish(dataSource.tellg(), false);
+      if (rowList_.size() % 4096 == 0) RunMetrics::global().add(RunMetrics::global().rowsParsed, 4096);
+    }
+    PROFILE_ROWS(rowList_.size());
+    RunMetrics::global().add(RunMetrics::global().rowsParsed, rowList_.size() % 4096);
+  }
+  dataSource.close();
+  if (progress_) progress_->publish(0, true);
+  finishReading();
+}
+
+/**
+ * Same as readFile, but only keeps a time-stratified reservoir sample of up to sampleCapacity rows per hour of data.
+ * The coordinates and the tag of a row are parsed only if the row is sampled. A second pass over the file finds
+ * the row before each sampled row in the order of time, for the estimates over pairs of consecutive rows,
+ * and parses a row only while it is the latest found before a sampled row.
+ */
+void User::readSample(std::string filename, int sampleCapacity) {
+  PROFILE_STAGE("readSample");
+  std::ifstream dataSource(filename);
+  if (!dataSource) {
+    std::cout << "ERROR: The file cannot be opened." << std::endl;
+    exit(0);
+  }
+
+  sample_.reset(new StratifiedReservoir(sampleCapacity));
   CSVRow row;
+  long rows = 0, skipped = 0;
   dataSource >> row; // skip the first line
   while (dataSource >> row) {
+    PROFILE_ROWS(1);
+    if (++rows % 4096 == 0) RunMetrics::global().add(RunMetrics::global().rowsParsed, 4096);
     tm tm = {};
-    std::stringstream ss(row[0]);
-    ss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
-    DataRow d(tm, stod(row[1]), stod(row[2]), row[3]);
-    rowList_.push_back(d);
-
-    if (cellMap_.count(row[3]) > 0) {
-      int idx = cellMap_[row[3]];
-      cellList_[idx].addDataRow(d);
-    } else {
-      Cell c(d, row[3]);
-      cellList_.push_back(c);
-      cellMap_[row[3]] = cellList_.size() - 1;
+    parseDateTime(row[0], tm);
+    int slot = sample_->offer(tm);
+    if (slot < 0) {
+      skipped++;
+      continue;
     }
+    sample_->place(slot, DataRow(tm, stod(row[1]), stod(row[2]), row[3]));
   }
+  RunMetrics::global().add(RunMetrics::global().rowsParsed, rows % 4096);
+  RunMetrics::global().add(RunMetrics::global().rowsSkipped, skipped);
 
-  for (Cell &c : cellList_) {
-    cellQueue_.push({c.getName(), c.numConnections()});
-    sort(c.getRowList().begin(), c.getRowList().end(), compareByTime());
+  sample_->finalize();
+  dataSource.clear();
+  dataSource.seekg(0);
+  dataSource >> row; // skip the first line
+  for (long line = 0; dataSource >> row; line++) {
+    tm tm = {};
+    parseDateTime(row[0], tm);
+    int slot = sample_->offerPredecessor(line, tm);
+    if (slot >= 0) sample_->placePredecessor(slot, DataRow(tm, stod(row[1]), stod(row[2]), row[3]));
   }
   dataSource.close();
-  sort(rowList_.begin(), rowList_.end(), compareByTime());
+
+  ROWLIST sample = sample_->rows();
+  estimate_ = estimateIngest(filename);
+  presize(sample.size(), estimate_.cells < sample.size() ? estimate_.cells : sample.size());
+  for (DataRow &d : sample) addRow(d);
+  finishReading();
+}
+
+// reserve rowList_ and the cell containers for the given numbers of rows and cells
+void User::presize(long rows, long cells) {
+  rowList_.reserve(rows);
+  cellList_.reserve(cells);
+  cellRows_.reserve(cells);
+  cellMap_.reserve(cells);
+}
+
+/**
+ * Append a row to rowList_ and count it for its cell.
+ * The rows of each cell are only copied to the cell by finishReading, once their number is known.
+ */
+void User::addRow(DataRow d) {
+  size_t rowCapacity = rowList_.capacity(), cellCapacity = cellList_.capacity();
+  rowList_.push_back(std::move(d));
+  const ArenaString &tag = rowList_.back().getTag();
+  int &cellID = cellMap_[tag];
+  if (cellRows_.size() < cellMap_.size()) { // a new cell, mapped to 0 by cellMap_
+    cellID = cellList_.size();
+    cellList_.push_back(Cell(tag));
+    cellRows_.push_back(0);
+  }
+  cellRows_[cellID]++;
+  rowList_.back().setCellID(cellID);
+  if (rowList_.capacity() != rowCapacity) reallocations_++;
+  if (cellList_.capacity() != cellCapacity) reallocations_++;
+}
+
+/**
+ * Sort rowList_, then fill the row list of each cell, reserved to its exact size, in the order of time.
+ * Containers reserved for more than 125% of their size are shrunk. In an arena too, the old buffer is returned
+ * to the system if it is a large block, or else goes to a free list of the arena for the next allocations.
+ */
+void User::finishReading() {
+  PROFILE_STAGE("finishReading");
+  PROFILE_ROWS(rowList_.size());
+  {
+    PROFILE_STAGE("sort");
+    sort(rowList_.begin(), rowList_.end(), compareByTime());
+  }
+  for (int i = 0; i < cellList_.size(); i++) cellList_[i].reserve(cellRows_[i]);
+  for (DataRow &d : rowList_) cellList_[d.getCellID()].addDataRow(d);
+
+  for (Cell &c : cellList_) {
+    int num = c.numConnections();
+    if (sample_) { // the estimated number of connections of the cell
+      double weights = 0;
+      for (DataRow &d : c.getRowList()) weights += sample_->weight(d.getDateTime());
+      num = (int)(weights + 0.5);
+    }
+    cellQueue_.push({c.getName(), num});
+  }
+
+  if (rowList_.capacity() > rowList_.size() + rowList_.size() / 4) rowList_.shrink_to_fit();
+  if (cellList_.capacity() > cellList_.size() + cellList_.size() / 4) cellList_.shrink_to_fit();
+}
+
+// Print statistics of the run of this user.
+void User::reportStats() {
+  *log_ << "\nIngest: estimated " << estimate_.rows << " rows and " << estimate_.cells << " cells, read "
+        << rowList_.size() << " rows and " << cellList_.size() << " cells, " << reallocations_ << " reallocations" << std::endl;
+}
+
+/**
+ * Print the estimated error of the results in the approximate mode:
+ * the share of rows in each area, and the mean speed between consecutive rows (sampled rows and their predecessors).
+ * Both are stratified estimates with their standard errors. The areas are those labelled from the sample, and the
+ * error of their shares is that of sampling their rows, not of labelling them: with few rows per hour, the stay
+ * times of the cells are shorter than in all rows, and the areas may differ from those labelled from all rows.
+ */
+void User::reportSampleError() {
+  if (!sample_) return;
+  long n = sample_->sampled(), total = sample_->seen();
+  log_->precision(4);
+  *log_ << "\nApproximate mode: " << n << " of " << total << " rows sampled (" << 100.0 * n / total << "%) in "
+        << sample_->numStrata() << " one-hour strata" << std::endl;
+
+  if (labelledInterval_ != 0) {
+    *log_ << "Areas labelled from the sample:" << std::endl;
+    const COLUMN<int> &areaID = graph_.areaID();
+    COLUMN<double> inArea(rowList_.size());
+    for (int a = 1; a <= areaCount_; a++) {
+      for (int i = 0; i < rowList_.size(); i++) inArea[i] = areaID[i] == a;
+      Estimate share = sample_->estimateMean(rowList_, inArea);
+      *log_ << "Area " << a << ": " << 100 * share.value << "% of rows (+/- " << 100 * share.stdError
+            << "%), about " << (long)(share.value * total + 0.5) << " rows" << std::endl;
+    }
+  }
+
+  if (total > 1) {
+    Estimate meanSpeed = sample_->estimatePairMean([](DataRow &previous, DataRow &d) {
+      double dt = difftime(getTimeValue(d.getDateTime()), getTimeValue(previous.getDateTime()));
+      return dt != 0 ? 3600 * distanceEarth(previous.getLat(), previous.getLon(), d.getLat(), d.getLon()) / dt : NAN;
+    });
+    *log_ << "Mean speed: " << meanSpeed.value << " km/hr (+/- " << meanSpeed.stdError << ")" << std::endl;
+  }
 }
 
 /**
@@ -96,19 +328,24 @@ void User::readFile(std::string filename) {
  * 3. For each selected cell, find time segments and calculate the stay time t.
  * 4. A cell is in a residential area if t > a constant time.
  * 5. Determine whether the discovered residential area A is new or not by checking if A can be merged to an existing residential area.
- * @returns the geojson files of each selected segment.
+ * The labels are kept for the areaID column, so repeated calls with the same interval are free.
+ * @returns the number of residential areas.
  */
-void User::findResidentialAreaByTopKCells(int interval) {
-  std::unordered_map<std::string, int> areaMap; // used to update areaID in each datarow
+int User::labelAreasByTopKCells(int interval) {
+  if (labelledInterval_ == interval) return areaCount_;
+  PROFILE_STAGE("labelAreasByTopKCells");
+  PROFILE_ROWS(rowList_.size());
+  areaMap_.clear();
   int areaID = 1;
   int topIdx = 1;
-  std::vector<std::vector<TIMEPAIR> > areaList; // used to store merged segments of each area
-  while (!cellQueue_.empty()) {
-    std::string cellTag = cellQueue_.top().first;
-    int num = cellQueue_.top().second;
+  std::vector<SEGMENTLIST, SegmentAllocator<SEGMENTLIST> > areaList; // used to store merged segments of each area
+  std::priority_queue<PAIR, std::vector<PAIR, CellAllocator<PAIR> >, compareBySecondValue> cellQueue = cellQueue_;
+  while (!cellQueue.empty()) {
+    ArenaString cellTag = cellQueue.top().first;
+    int num = cellQueue.top().second;
     // std::cout << "\nTop" << topIdx++ << ": ";
-    // std::cout << cellTag << ", Num:" << cellQueue_.top().second << std::endl;
-    std::vector<TIMEPAIR> currSegList = cellList_[cellMap_[cellTag]].getTimeSegments(interval);
+    // std::cout << cellTag << ", Num:" << cellQueue.top().second << std::endl;
+    SEGMENTLIST currSegList = cellList_[cellMap_[cellTag]].getTimeSegments(interval);
     
     // break when numConnections of this cell is too small (i.e., the stayTime cannot be greater than 3600s)
     if (num < 3600 / interval) break;
@@ -118,37 +355,60 @@ void User::findResidentialAreaByTopKCells(int interval) {
     if(stayTime > 3600) { // > 1 hr
       bool merged = false;
       for(int i = 0; i < areaList.size(); i++) {
-        std::vector<TIMEPAIR> mergedSegList = merge(currSegList, areaList[i]);    
+        SEGMENTLIST mergedSegList = merge(currSegList, areaList[i]);    
         // some segments are overlapped if some segments are merged
         if (mergedSegList.size() < currSegList.size() + areaList[i].size()) { 
-          areaList[i] = mergedSegList;
-          areaMap[cellTag] = i + 1; // areaID = index + 1
+          areaList[i] = std::move(mergedSegList);
+          areaMap_[cellTag] = i + 1; // areaID = index + 1
           merged = true;
           break;
         }
       }
       // this area is new
       if (!merged) {
-        areaMap[cellTag] = areaID++;
-        areaList.push_back(currSegList);
+        areaMap_[cellTag] = areaID++;
+        areaList.push_back(std::move(currSegList));
       }
     }
-    cellQueue_.pop();
+    cellQueue.pop();
   }
 
-  std::ofstream ofsArea("time-vs-area.csv"); // output the file for plotting
+  cellArea_.assign(cellList_.size(), 0);
+  for (TAGMAP::iterator it = areaMap_.begin(); it != areaMap_.end(); ++it) cellArea_[cellMap_[it->first]] = it->second;
+  areaCount_ = areaID - 1;
+  labelledInterval_ = interval;
+  graph_.setAreaLabeler([this](DataRow &r) { return areaOf(r); });
+  return areaCount_;
+}
+
+/**
+ * Label residential areas by labelAreasByTopKCells, then output the areaID of each datarow and the midpoint of each area.
+ * @returns the files for plotting and the inputs of the web calculator.
+ */
+void User::findResidentialAreaByTopKCells(int interval) {
+  PROFILE_STAGE("findResidentialAreaByTopKCells");
+  int areaCount = labelAreasByTopKCells(interval);
+
+  std::ofstream ofsArea(outputPrefix_ + "time-vs-area.csv"); // output the file for plotting
   ofsArea << "time,areaID" << std::endl;
-  // update areaID of each datarow and output 
-  for (auto &r : rowList_) {
-    if (areaMap.count(r.getTag()) > 0)
-      r.setAreaID(areaMap[r.getTag()]);
-    ofsArea << getTimeString(r.getDateTime(), 1) << "," << r.getAreaID() << std::endl;
-  }
+  const COLUMN<int> &areaID = graph_.areaID();
+  for (int i = 0; i < rowList_.size(); i++)
+    ofsArea << getTimeString(rowList_[i].getDateTime(), 1) << "," << areaID[i] << std::endl;
+  PROFILE_ROWS(rowList_.size());
+  countBytesWritten(ofsArea.tellp());
   ofsArea.close();
 
-  midpointAnalysis(rowList_, areaID - 1, false);  // Center of Gravity
-  midpointAnalysis(rowList_, areaID - 1, true); // Average
-  generateGeoFiles(rowList_, areaID - 1); // for calculating center of minimum distance via web http://www.geomidpoint.com/
+  outputMidpoints(areaCount, ANALYSIS_TOPK_CELLS);
+}
+
+void User::outputMidpoints(int areaCount, int outputs) {
+  if (outputs & (OUTPUT_MIDPOINT | OUTPUT_CDF)) {
+    std::ostream *log = (outputs & OUTPUT_MIDPOINT) ? log_ : nullptr;
+    midpointAnalysis(graph_, areaCount, false, log, outputPrefix_, outputs & OUTPUT_CDF);  // Center of Gravity
+    midpointAnalysis(graph_, areaCount, true, log, outputPrefix_, outputs & OUTPUT_CDF); // Average
+  }
+  if (outputs & OUTPUT_GEO)
+    generateGeoFiles(graph_, areaCount, outputPrefix_); // for calculating center of minimum distance via web http://www.geomidpoint.com/
 }
 
 /**
@@ -162,28 +422,166 @@ void User::findResidentialAreaByTopKCells(int interval) {
 #define movingSpeed 0.0125  // Human speed: 45 km per hour = 0.0125 km per second
 #define upscalingFactor 1.1 // Upscale the distance between two locations because the distance is an airline distance.
 #define minInterval 1800     // seconds
+
+// Scan kernels used by analyse(), each producing the same file(s) as the analysis named in its comment.
+
+// findResidentialAreaByTopKCells: time-vs-area.csv
+class AreaSeriesKernel : public ScanKernel {
+private:
+  std::string prefix_;
+  std::ofstream ofsArea_;
+
+public:
+  AreaSeriesKernel(std::string prefix) : prefix_(prefix) {};
+  int needs() { return SCAN_AREA; };
+  void begin() {
+    ofsArea_.open(prefix_ + "time-vs-area.csv");
+    ofsArea_ << "time,areaID" << std::endl;
+  };
+  void visit(const ScanRow &r) {
+    ofsArea_ << getTimeString(r.row->getDateTime(), 1) << "," << r.areaID << std::endl;
+  };
+  void end() {
+    countBytesWritten(ofsArea_.tellp());
+    ofsArea_.close();
+  };
+};
+
+// calculateSpeedOfEachTime: time-vs-speed.csv
+class SpeedSeriesKernel : public ScanKernel {
+private:
+  std::string prefix_;
+  std::ofstream ofsSpeed_;
+
+public:
+  SpeedSeriesKernel(std::string prefix) : prefix_(prefix) {};
+  int needs() { return SCAN_PAIR; };
+  void begin() {
+    ofsSpeed_.open(prefix_ + "time-vs-speed.csv");
+    ofsSpeed_ << "time,speed" << std::endl;
+  };
+  void visit(const ScanRow &r) {
+    if (r.index == 0 || r.pairTimeDiff == 0) return;
+    double speed = 3600 * r.pairDistance / r.pairTimeDiff; // km per hour
+    ofsSpeed_ << getTimeString(r.row->getDateTime(), 1) << "," << speed << std::endl;
+  };
+  void end() {
+    countBytesWritten(ofsSpeed_.tellp());
+    ofsSpeed_.close();
+  };
+};
+
+// findResidentialAreaBySpeed: map-by-speed-*.json
+class SpeedSegmentKernel : public ScanKernel {
+private:
+  std::string prefix_;
+  int mapID_;
+  std::vector<double> coords_; // lon, lat of each row in the current segment
+  tm lowDateTime_, highDateTime_;
+  time_t lowTime_, highTime_;
+
+  void output() {
+    if (difftime(highTime_, lowTime_) <= minInterval) return;
+    std::string mapFile = prefix_ + "map-by-speed-" + std::to_string(mapID_++) + "-" + 
+                          getTimeString(lowDateTime_, 0) + "-to-" + 
+                          getTimeString(highDateTime_, 0) + ".json";
+    createJsonFile(mapFile, coords_);
+  };
+
+public:
+  SpeedSegmentKernel(std::string prefix) : prefix_(prefix) {};
+  int needs() { return SCAN_PAIR; };
+  void begin() {
+    mapID_ = 1;
+    coords_.clear();
+  };
+  void visit(const ScanRow &r) {
+    if (r.pairDistance != 0 && r.pairTimeDiff != 0 && r.pairDistance * upscalingFactor / r.pairTimeDiff > movingSpeed) {
+      output();
+      coords_.clear();
+    }
+    if (coords_.empty()) {
+      lowDateTime_ = r.row->getDateTime();
+      lowTime_ = r.time;
+    }
+    coords_.push_back(r.row->getLon());
+    coords_.push_back(r.row->getLat());
+    highDateTime_ = r.row->getDateTime();
+    highTime_ = r.time;
+  };
+  void end() {
+    // output the last segment
+    if (!coords_.empty()) output();
+  };
+};
+
+// numConnections and getTimeSegments of one cell, printed to a log
+class CellSegmentKernel : public ScanKernel {
+private:
+  ArenaString cell_;
+  int interval_;
+  bool printConnections_, printSegments_;
+  std::ostream *log_;
+  long connections_;
+  SEGMENTLIST segmentList_;
+  TIMEPAIR segment_;
+  time_t lowTime_;
+
+public:
+  CellSegmentKernel(std::string cell, int interval, bool printConnections, bool printSegments, std::ostream &log) :
+    cell_(cell.data(), cell.size()), interval_(interval), printConnections_(printConnections),
+    printSegments_(printSegments), log_(&log) {};
+  int needs() { return SCAN_TIME; };
+  void begin() {
+    connections_ = 0;
+    segmentList_.clear();
+  };
+  void visit(const ScanRow &r) {
+    if (r.row->getTag() != cell_) return;
+    if (connections_++ == 0) {
+      segment_.first = r.row->getDateTime();
+      lowTime_ = r.time;
+    } else if (difftime(r.time, lowTime_) > interval_) {
+      segmentList_.push_back(segment_);
+      segment_.first = r.row->getDateTime();
+      lowTime_ = r.time;
+    }
+    segment_.second = r.row->getDateTime();
+  };
+  void end() {
+    if (connections_ == 0) {
+      *log_ << "ERROR: This cell does not exist." << std::endl;
+      return;
+    }
+    segmentList_.push_back(segment_);
+    if (printConnections_) *log_ << cell_ << " connections: " << connections_ << std::endl;
+    if (printSegments_) {
+      for (TIMEPAIR tp : segmentList_)
+        *log_ << getTimeString(tp.first, 0) << "-to-" << getTimeString(tp.second, 0) << std::endl;
+    }
+  };
+};
+
 void User::findResidentialAreaBySpeed() {
+  PROFILE_STAGE("findResidentialAreaBySpeed");
+  PROFILE_ROWS(rowList_.size());
+  const COLUMN<time_t> &t = graph_.time();
+  const COLUMN<double> &shift = graph_.pairDistance();
+  const COLUMN<double> &dt = graph_.pairTimeDiff();
   int mapID = 1;
   int low = 0, high = 0;
   double stayInterval = 0;
   for (int i = 1; i < rowList_.size(); i++) {
     high = i;
-    double currShift = distanceEarth(
-      rowList_[i - 1].getLat(), rowList_[i - 1].getLon(),
-      rowList_[i].getLat(), rowList_[i].getLon()
-      );
-    double timeDiff = difftime(getTimeValue(rowList_[i].getDateTime()), getTimeValue(rowList_[i - 1].getDateTime()));
-    if (timeDiff < 0) {
-      std::cout << "ERROR: timeDiff < 0. " << timeDiff << std::endl;
-      exit(0);
-    }
+    double currShift = shift[i];
+    double timeDiff = dt[i];
     if (currShift == 0 || timeDiff == 0) continue;
 
     double speed = currShift * upscalingFactor / timeDiff;
     if (speed > movingSpeed) {
-      stayInterval = difftime(getTimeValue(rowList_[high - 1].getDateTime()), getTimeValue(rowList_[low].getDateTime()));
+      stayInterval = difftime(t[high - 1], t[low]);
       if (stayInterval > minInterval) {
-        std::string mapFile = "map-by-speed-" + std::to_string(mapID++) + "-" + 
+        std::string mapFile = outputPrefix_ + "map-by-speed-" + std::to_string(mapID++) + "-" + 
                               getTimeString(rowList_[low].getDateTime(), 0) + "-to-" + 
                               getTimeString(rowList_[high - 1].getDateTime(), 0) + ".json";
         createJsonFile(mapFile, rowList_, low, high);
@@ -194,9 +592,9 @@ void User::findResidentialAreaBySpeed() {
   
   // output the last segment
   high++;
-  stayInterval = difftime(getTimeValue(rowList_[high - 1].getDateTime()), getTimeValue(rowList_[low].getDateTime()));
+  stayInterval = difftime(t[high - 1], t[low]);
   if (stayInterval > minInterval) {
-    std::string mapFile = "map-by-speed-" + std::to_string(mapID++) + "-" + 
+    std::string mapFile = outputPrefix_ + "map-by-speed-" + std::to_string(mapID++) + "-" + 
                           getTimeString(rowList_[low].getDateTime(), 0) + "-to-" + 
                           getTimeString(rowList_[high - 1].getDateTime(), 0) + ".json";
     createJsonFile(mapFile, rowList_, low, high);
@@ -204,23 +602,57 @@ void User::findResidentialAreaBySpeed() {
 }
 
 void User::calculateSpeedOfEachTime() {
-  std::ofstream ofsSpeed("time-vs-speed.csv");
+  PROFILE_STAGE("calculateSpeedOfEachTime");
+  PROFILE_ROWS(rowList_.size());
+  const COLUMN<double> &dt = graph_.pairTimeDiff();
+  const COLUMN<double> &speed = graph_.speed(); // km per hour
+  std::ofstream ofsSpeed(outputPrefix_ + "time-vs-speed.csv");
   ofsSpeed << "time,speed" << std::endl;
   for (int i = 1; i < rowList_.size(); i++) {
-    double currShift = distanceEarth(
-      rowList_[i - 1].getLat(), rowList_[i - 1].getLon(),
-      rowList_[i].getLat(), rowList_[i].getLon());
-    
-    double timeDiff = difftime(getTimeValue(rowList_[i].getDateTime()), getTimeValue(rowList_[i - 1].getDateTime()));
-    
-    if (timeDiff < 0) {
-      std::cout << "ERROR: timeDiff < 0. " << timeDiff << std::endl;
-      exit(0);
-    }
-    if (timeDiff == 0) continue;
-    
-    double speed = 3600 * currShift / timeDiff; // km per hour
-    ofsSpeed << getTimeString(rowList_[i].getDateTime(), 1) << "," << speed << std::endl;
+    if (dt[i] == 0) continue;
+    ofsSpeed << getTimeString(rowList_[i].getDateTime(), 1) << "," << speed[i] << std::endl;
   }
+  countBytesWritten(ofsSpeed.tellp());
   ofsSpeed.close();
 }
+
+/**
+ * Produce the selected outputs (a combination of Output flags), scheduling only the stages they need:
+ * 1. Areas are labelled only for the area, midpoint, CDF, geo and prediction outputs.
+ * 2. Midpoints are computed only for the midpoint and CDF outputs.
+ * 3. Rows are scanned once, and only for the area series, speed series, speed map, transitions, prediction
+ *    and co-location outputs; the scan computes the time and pair values of each row as it visits it,
+ *    and reads the areaID column of graph_ if the midpoints have labelled it, so no column is built for the scan.
+ * The output files are the same as calling each analysis on its own.
+ */
+void User::analyse(int interval, int outputs) {
+  PROFILE_STAGE("analyse");
+  ScanEngine engine;
+  AreaSeriesKernel areaSeries(outputPrefix_);
+  SpeedSeriesKernel speedSeries(outputPrefix_);
+  SpeedSegmentKernel speedSegment(outputPrefix_);
+  TransitionKernel transitions(outputPrefix_);
+  NextLocationKernel nextLocation(outputPrefix_);
+  ColocationKernel colocation(colocation_, userID_);
+  int areaCount = 0;
+  if (outputs & (ANALYSIS_TOPK_CELLS | OUTPUT_PREDICTION)) areaCount = labelAreasByTopKCells(interval);
+  outputMidpoints(areaCount, outputs);
+  if (outputs & OUTPUT_AREA) engine.add(&areaSeries);
+  if (outputs & OUTPUT_SPEED) engine.add(&speedSeries);
+  if (outputs & OUTPUT_MAP) engine.add(&speedSegment);
+  if (outputs & OUTPUT_TRANSITIONS) engine.add(&transitions);
+  if (outputs & OUTPUT_PREDICTION) engine.add(&nextLocation);
+  if ((outputs & OUTPUT_COLOCATION) && colocation_) engine.add(&colocation);
+  if (!engine.empty()) engine.run(graph_);
+  if (outputs & OUTPUT_TRANSITIONS) transitions_ = transitions.matrix();
+  if ((outputs & OUTPUT_PREDICTION) && !rowList_.empty()) { // from the last row of the user
+    DataRow &last = rowList_.back();
+    std::string cell(last.getTag().data(), last.getTag().size());
+    Prediction next[3];
+    int n = nextLocation.index().predict(cell, last.getDateTime(), next);
+    *log_ << "\nNext areas from " << cell << " at " << getTimeString(last.getDateTime(), 1) << ":";
+    for (int i = 0; i < n; i++) *log_ << " " << next[i].area << " (" << next[i].probability << ")";
+    if (n == 0) *log_ << " none";
+    *log_ << std::endl;
+  }
+}